@@ -4,265 +4,3083 @@
 #include <vector>
 #include <chrono>
 #include <thread>
-#include <sstream>
+#include <charconv>
 #include <algorithm>
 #include <cctype>
+#include <string_view>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <filesystem>
+#include <unordered_map>
+#include <deque>
+#include <memory>
+#include <future>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 #ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // windows.h 的 min/max 宏会破坏 std::min/std::max
+#endif
 #include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define MA_ENABLE_MP3
+#define MINIAUDIO_IMPLEMENTATION
+#include "miniaudio.h"
+
+// 指令类型枚举
+enum class CommandType : uint8_t {
+    PRINT_TEXT, NEWLINE, NEWLINE_NO_PROMPT, CLEAR_SCREEN, MOVE_CURSOR, 
+    STYLE_BOLD, STYLE_ITALIC, STYLE_UNDERLINE, STYLE_STRIKETHROUGH, STYLE_RESET, COLOR_RGB, BACKGROUND_RGB
+};
+
+// 播放指令的数据结构 (解析时逐条构造，随后压缩进 ActionTable)
+struct PlaybackAction {
+    int sourceLineNumber; std::chrono::milliseconds timestamp; CommandType type;
+    std::string_view text_payload; int cursor_row; int cursor_col; int r = 0, g = 0, b = 0, a = 0;
+};
+
+// 文本载荷驻留池。内容相同的载荷只保存一次，动作以 32 位编号引用。
+// 来自映射区或静态缓冲区的文本只登记视图而不复制; 转义还原等临时生成的文本在首次出现时复制进池自有的内存块。
+class TextArena {
+public:
+    struct Stats {
+        uint64_t references = 0;       // 驻留请求次数 (即引用文本的动作数)
+        uint64_t referencedBytes = 0;  // 所有引用的文本总字节数
+        uint64_t ownedBytes = 0;       // 复制进池自有内存块的字节数
+    };
+
+    // 驻留一段生命周期不短于本池的文本
+    uint32_t intern(std::string_view text) { return internImpl(text, false); }
+    // 驻留一段临时文本，首次出现时复制
+    uint32_t internCopy(std::string_view text) { return internImpl(text, true); }
+    // 不查重直接登记 (调用方已保证唯一，例如 .clipb 的字符串池)
+    uint32_t add(std::string_view text) {
+        stats_.references++;
+        stats_.referencedBytes += text.size();
+        return addSpan(text);
+    }
+
+    // 记录一次对已登记文本的重复引用 (只影响统计)
+    void countReference(size_t bytes) {
+        stats_.references++;
+        stats_.referencedBytes += bytes;
+    }
+
+    std::string_view get(uint32_t id) const { return spans_[id]; }
+    size_t distinct() const { return spans_.size(); }
+    uint64_t distinctBytes() const { return distinctBytes_; }
+    const Stats& stats() const { return stats_; }
+
+    // 构建完成后丢弃查重索引，只保留文本本身
+    void freeze() { std::unordered_map<std::string_view, uint32_t>().swap(index_); }
+
+    void clear() {
+        spans_.clear();
+        index_.clear();
+        blocks_.clear();
+        current_ = nullptr;
+        currentLeft_ = 0;
+        nextBlockSize_ = FIRST_BLOCK_SIZE;
+        stats_ = {};
+        distinctBytes_ = 0;
+    }
+
+    // 并入另一个池 (接管其内存块)，返回对方编号到本池编号的映射
+    std::vector<uint32_t> merge(TextArena& other) {
+        std::vector<uint32_t> remap(other.spans_.size());
+        for (size_t i = 0; i < other.spans_.size(); ++i) {
+            auto found = index_.find(other.spans_[i]);
+            remap[i] = found != index_.end() ? found->second : addSpan(other.spans_[i]);
+        }
+        for (auto& block : other.blocks_) blocks_.push_back(std::move(block));
+        stats_.references += other.stats_.references;
+        stats_.referencedBytes += other.stats_.referencedBytes;
+        stats_.ownedBytes += other.stats_.ownedBytes;
+        other.clear();
+        return remap;
+    }
+
+private:
+    // 内存块从小块起步逐次翻倍: 流式播放的每个槽位各有一个池，只存一行的转义文本时不应占满一个大块
+    static constexpr size_t FIRST_BLOCK_SIZE = 256;
+    static constexpr size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+    uint32_t internImpl(std::string_view text, bool copy) {
+        stats_.references++;
+        stats_.referencedBytes += text.size();
+        auto found = index_.find(text);
+        if (found != index_.end()) return found->second;
+        return addSpan(copy ? store(text) : text);
+    }
+
+    uint32_t addSpan(std::string_view text) {
+        const uint32_t id = static_cast<uint32_t>(spans_.size());
+        spans_.push_back(text);
+        index_.emplace(text, id);
+        distinctBytes_ += text.size();
+        return id;
+    }
+
+    std::string_view store(std::string_view text) {
+        stats_.ownedBytes += text.size();
+        if (text.size() > currentLeft_) {
+            const size_t size = std::max(nextBlockSize_, text.size());
+            nextBlockSize_ = std::min(nextBlockSize_ * 2, MAX_BLOCK_SIZE);
+            blocks_.push_back(std::make_unique<char[]>(size));
+            current_ = blocks_.back().get();
+            currentLeft_ = size;
+        }
+        std::memcpy(current_, text.data(), text.size());
+        std::string_view stored(current_, text.size());
+        current_ += text.size();
+        currentLeft_ -= text.size();
+        return stored;
+    }
+
+    std::vector<std::string_view> spans_;
+    std::unordered_map<std::string_view, uint32_t> index_;
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* current_ = nullptr;
+    size_t currentLeft_ = 0;
+    size_t nextBlockSize_ = FIRST_BLOCK_SIZE;
+    Stats stats_;
+    uint64_t distinctBytes_ = 0;
+};
+
+// 列式动作表。时间戳与类型各占一列，播放时顺序扫描的只有这两列; 载荷列按类型索引到文本驻留池
+// (PRINT_TEXT) 或紧凑参数表 (光标位置、颜色)，无载荷的样式指令不占额外空间。行号只在报错时使用。
+class ActionTable {
+public:
+    // 光标: x = 行, y = 列; 颜色: x = 0xRRGGBBAA
+    struct PackedArgs { int32_t x, y; };
+
+    void append(const PlaybackAction& action) {
+        timestamps_.push_back(action.timestamp.count());
+        types_.push_back(action.type);
+        lines_.push_back(action.sourceLineNumber);
+        switch (action.type) {
+            case CommandType::PRINT_TEXT:
+                payloads_.push_back(texts_.intern(action.text_payload));
+                break;
+            case CommandType::MOVE_CURSOR:
+                payloads_.push_back(static_cast<uint32_t>(args_.size()));
+                args_.push_back({action.cursor_row, action.cursor_col});
+                break;
+            case CommandType::COLOR_RGB:
+            case CommandType::BACKGROUND_RGB:
+                payloads_.push_back(static_cast<uint32_t>(args_.size()));
+                args_.push_back({static_cast<int32_t>(packRgba(action.r, action.g, action.b, action.a)), 0});
+                break;
+            default:
+                payloads_.push_back(0);
+                break;
+        }
+    }
+
+    // 追加一条文本已在本表驻留池中登记过的 PRINT_TEXT 动作
+    void appendText(int sourceLine, std::chrono::milliseconds timestamp, uint32_t textId) {
+        timestamps_.push_back(timestamp.count());
+        types_.push_back(CommandType::PRINT_TEXT);
+        lines_.push_back(sourceLine);
+        payloads_.push_back(textId);
+    }
+
+    // 追加另一张表的全部动作 (并接管其文本)，行号加上 lineOffset
+    void append(ActionTable& other, int lineOffset) {
+        const std::vector<uint32_t> textRemap = texts_.merge(other.texts_);
+        const uint32_t argBase = static_cast<uint32_t>(args_.size());
+        timestamps_.insert(timestamps_.end(), other.timestamps_.begin(), other.timestamps_.end());
+        types_.insert(types_.end(), other.types_.begin(), other.types_.end());
+        for (int line : other.lines_) lines_.push_back(line + lineOffset);
+        for (size_t i = 0; i < other.size(); ++i) {
+            switch (other.types_[i]) {
+                case CommandType::PRINT_TEXT: payloads_.push_back(textRemap[other.payloads_[i]]); break;
+                case CommandType::MOVE_CURSOR: case CommandType::COLOR_RGB: case CommandType::BACKGROUND_RGB: payloads_.push_back(other.payloads_[i] + argBase); break;
+                default: payloads_.push_back(0); break;
+            }
+        }
+        args_.insert(args_.end(), other.args_.begin(), other.args_.end());
+    }
+
+    void reserve(size_t count) {
+        timestamps_.reserve(count);
+        types_.reserve(count);
+        payloads_.reserve(count);
+        lines_.reserve(count);
+    }
+
+    void clear() {
+        timestamps_.clear(); types_.clear(); payloads_.clear(); lines_.clear(); texts_.clear(); args_.clear();
+    }
+
+    size_t size() const { return types_.size(); }
+    bool empty() const { return types_.empty(); }
+
+    std::chrono::milliseconds timestamp(size_t i) const { return std::chrono::milliseconds(timestamps_[i]); }
+    CommandType type(size_t i) const { return types_[i]; }
+    int sourceLine(size_t i) const { return lines_[i]; }
+    std::string_view text(size_t i) const { return texts_.get(payloads_[i]); }
+    int cursorRow(size_t i) const { return args_[payloads_[i]].x; }
+    int cursorCol(size_t i) const { return args_[payloads_[i]].y; }
+    uint32_t rgba(size_t i) const { return static_cast<uint32_t>(args_[payloads_[i]].x); }
+
+    TextArena& texts() { return texts_; }
+    const TextArena& texts() const { return texts_; }
+
+    static uint32_t packRgba(int r, int g, int b, int a) {
+        return (static_cast<uint32_t>(r & 0xFF) << 24) | (static_cast<uint32_t>(g & 0xFF) << 16) | (static_cast<uint32_t>(b & 0xFF) << 8) | static_cast<uint32_t>(a & 0xFF);
+    }
+
+private:
+    std::vector<int64_t> timestamps_;       // 毫秒
+    std::vector<CommandType> types_;
+    std::vector<uint32_t> payloads_;        // texts_ 的编号或 args_ 的下标
+    std::vector<int32_t> lines_;
+    TextArena texts_;
+    std::vector<PackedArgs> args_;
+};
+
+// 指向动作表中一行的轻量引用，预渲染与播放只通过它访问动作
+struct ActionRef {
+    const ActionTable* table = nullptr;
+    size_t index = 0;
+
+    std::chrono::milliseconds timestamp() const { return table->timestamp(index); }
+    CommandType type() const { return table->type(index); }
+    int sourceLine() const { return table->sourceLine(index); }
+    std::string_view text() const { return table->text(index); }
+    int cursorRow() const { return table->cursorRow(index); }
+    int cursorCol() const { return table->cursorCol(index); }
+    int r() const { return static_cast<int>(table->rgba(index) >> 24); }
+    int g() const { return static_cast<int>((table->rgba(index) >> 16) & 0xFF); }
+    int b() const { return static_cast<int>((table->rgba(index) >> 8) & 0xFF); }
+    int a() const { return static_cast<int>(table->rgba(index) & 0xFF); }
+    uint32_t rgba() const { return table->rgba(index); }
+};
+
+// --- 预渲染 ---
+// 解析完成后所有动作都已确定，因此加载时就把每个动作转换为最终写往终端的字节，首尾相接存放在一块连续缓冲区中。
+// 播放时只写出字节区间，热路径上没有整数格式化，也不经过 iostream 的流状态。
+
+// 追加十进制整数
+inline void appendInt(std::string& out, int value) {
+    char digits[16];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+// 把一个非样式动作渲染为字节; 样式与颜色由渲染器经 SgrState 合并后输出
+void renderAction(const ActionRef& action, const std::string& username, std::string& out) {
+    switch (action.type()) {
+        case CommandType::PRINT_TEXT: out += action.text(); break;
+        case CommandType::NEWLINE: out += '\n'; out += username; out += "> "; break;
+        case CommandType::NEWLINE_NO_PROMPT: out += '\n'; break;
+        case CommandType::CLEAR_SCREEN: out += "\033[2J\033[H"; break;
+        case CommandType::MOVE_CURSOR:
+            out += "\033[";
+            appendInt(out, action.cursorRow());
+            out += ';';
+            appendInt(out, action.cursorCol());
+            out += 'H';
+            break;
+        default: break;
+    }
+}
+
+inline bool isSgrAction(CommandType type) {
+    return type == CommandType::STYLE_BOLD || type == CommandType::STYLE_ITALIC || type == CommandType::STYLE_UNDERLINE || type == CommandType::STYLE_STRIKETHROUGH ||
+           type == CommandType::STYLE_RESET || type == CommandType::COLOR_RGB || type == CommandType::BACKGROUND_RGB;
+}
+
+// --- 终端色深 ---
+// 真彩色以外的终端只认调色板下标。RGB 到下标的换算在加载时通过查找表完成，预渲染出的转义序列直接使用下标，也更短。
+enum class ColorDepth { TRUECOLOR, PALETTE_256, PALETTE_16 };
+
+// 根据 COLORTERM / TERM 推断终端支持的色深。只有 TERM 明确声明了较少的颜色时才降级，
+// 其余 (包括许多真彩色终端仍在报告的 xterm) 保持真彩色输出; 需要降级时用 --colors 显式指定。
+ColorDepth detectColorDepth() {
+    const char* colorterm = std::getenv("COLORTERM");
+    if (colorterm && (std::strstr(colorterm, "truecolor") || std::strstr(colorterm, "24bit"))) return ColorDepth::TRUECOLOR;
+    const char* term = std::getenv("TERM");
+    if (!term || !*term) return ColorDepth::TRUECOLOR; // 例如 Windows 控制台，不设置 TERM 但支持真彩色
+    const std::string_view name = term;
+    if (name.find("direct") != std::string_view::npos || name.find("truecolor") != std::string_view::npos) return ColorDepth::TRUECOLOR;
+    if (name.find("256") != std::string_view::npos) return ColorDepth::PALETTE_256;
+    if (name == "linux" || name == "ansi" || name == "cons25" || name.substr(0, 2) == "vt" || name.find("-16color") != std::string_view::npos) return ColorDepth::PALETTE_16;
+    return ColorDepth::TRUECOLOR;
+}
+
+// 把脚本中的 0xRRGGBBAA 换算为颜色代码: 高字节标明色深，低位为 RGB 或调色板下标
+class ColorMapper {
+public:
+    static constexpr uint32_t TAG_RGB = 1u << 24;
+    static constexpr uint32_t TAG_256 = 2u << 24;
+    static constexpr uint32_t TAG_16 = 3u << 24;
+
+    explicit ColorMapper(ColorDepth depth) : depth_(depth) {
+        if (depth == ColorDepth::PALETTE_256) buildCubeTables();
+        if (depth == ColorDepth::PALETTE_16) buildAnsiTable();
+    }
+
+    uint32_t map(uint32_t rgba) const {
+        const int r = static_cast<int>(rgba >> 24);
+        const int g = static_cast<int>((rgba >> 16) & 0xFF);
+        const int b = static_cast<int>((rgba >> 8) & 0xFF);
+        switch (depth_) {
+            case ColorDepth::TRUECOLOR: return TAG_RGB | (rgba >> 8);
+            case ColorDepth::PALETTE_256: {
+                // 6x6x6 色块中最近的一格与 24 级灰阶中最近的一级，取距离较小者
+                const int cube = 16 + 36 * cubeIndex_[r] + 6 * cubeIndex_[g] + cubeIndex_[b];
+                const int cubeDistance = distance(r, g, b, CUBE_LEVELS[cubeIndex_[r]], CUBE_LEVELS[cubeIndex_[g]], CUBE_LEVELS[cubeIndex_[b]]);
+                const int gray = grayIndex_[(r + g + b) / 3];
+                const int level = 8 + 10 * gray;
+                return TAG_256 | static_cast<uint32_t>(distance(r, g, b, level, level, level) < cubeDistance ? 232 + gray : cube);
+            }
+            case ColorDepth::PALETTE_16: return TAG_16 | ansiIndex_[((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3)];
+        }
+        return TAG_RGB | (rgba >> 8);
+    }
+
+    // 追加一个颜色的 SGR 参数，例如 "38;2;r;g;b"、"48;5;n" 或 "91"
+    static void appendParams(std::string& out, bool background, uint32_t code) {
+        const uint32_t value = code & 0xFFFFFF;
+        switch (code & 0xFF000000) {
+            case TAG_256:
+                out += background ? "48;5;" : "38;5;";
+                appendInt(out, static_cast<int>(value));
+                break;
+            case TAG_16:
+                appendInt(out, static_cast<int>(value < 8 ? (background ? 40 : 30) + value : (background ? 100 : 90) + value - 8));
+                break;
+            default:
+                out += background ? "48;2;" : "38;2;";
+                appendInt(out, static_cast<int>(value >> 16));
+                out += ';';
+                appendInt(out, static_cast<int>((value >> 8) & 0xFF));
+                out += ';';
+                appendInt(out, static_cast<int>(value & 0xFF));
+                break;
+        }
+    }
+
+private:
+    static constexpr int CUBE_LEVELS[6] = {0, 95, 135, 175, 215, 255};
+
+    static int distance(int r1, int g1, int b1, int r2, int g2, int b2) { return (r1 - r2) * (r1 - r2) + (g1 - g2) * (g1 - g2) + (b1 - b2) * (b1 - b2); }
+
+    // 每个通道值到最近的色块级别、每个亮度到最近的灰阶
+    void buildCubeTables() {
+        for (int value = 0; value < 256; ++value) {
+            int best = 0;
+            for (int i = 1; i < 6; ++i) if (std::abs(CUBE_LEVELS[i] - value) < std::abs(CUBE_LEVELS[best] - value)) best = i;
+            cubeIndex_[value] = static_cast<uint8_t>(best);
+            grayIndex_[value] = static_cast<uint8_t>(std::clamp((value - 3) / 10, 0, 23));
+        }
+    }
+
+    // 16 色没有规则的结构: 每通道量化到 5 位，预先为 32768 个格子各找出最近的标准 ANSI 颜色
+    void buildAnsiTable() {
+        static constexpr int ANSI[16][3] = {
+            {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0}, {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+            {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0}, {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255},
+        };
+        ansiIndex_.resize(32 * 32 * 32);
+        for (size_t cell = 0; cell < ansiIndex_.size(); ++cell) {
+            const int r = static_cast<int>(cell >> 10) * 8 + 4;
+            const int g = static_cast<int>((cell >> 5) & 31) * 8 + 4;
+            const int b = static_cast<int>(cell & 31) * 8 + 4;
+            int best = 0;
+            for (int i = 1; i < 16; ++i) if (distance(r, g, b, ANSI[i][0], ANSI[i][1], ANSI[i][2]) < distance(r, g, b, ANSI[best][0], ANSI[best][1], ANSI[best][2])) best = i;
+            ansiIndex_[cell] = static_cast<uint8_t>(best);
+        }
+    }
+
+    ColorDepth depth_;
+    uint8_t cubeIndex_[256] = {};
+    uint8_t grayIndex_[256] = {};
+    std::vector<uint8_t> ansiIndex_;
+};
+
+// 终端的 SGR (样式与颜色) 状态。渲染器用它分别跟踪脚本要求的状态与终端上的实际状态。
+struct SgrState {
+    bool bold = false;
+    bool italic = false;
+    bool underline = false;
+    bool strikethrough = false;
+    bool hasForeground = false;
+    bool hasBackground = false;
+    uint32_t foreground = 0; // 颜色代码，见 ColorMapper
+    uint32_t background = 0;
+
+    void apply(const ActionRef& action, const ColorMapper& colors) {
+        switch (action.type()) {
+            case CommandType::STYLE_BOLD: bold = true; break;
+            case CommandType::STYLE_ITALIC: italic = true; break;
+            case CommandType::STYLE_UNDERLINE: underline = true; break;
+            case CommandType::STYLE_STRIKETHROUGH: strikethrough = true; break;
+            case CommandType::STYLE_RESET: *this = SgrState(); break;
+            case CommandType::COLOR_RGB: hasForeground = true; foreground = colors.map(action.rgba()); break;
+            case CommandType::BACKGROUND_RGB: hasBackground = true; background = colors.map(action.rgba()); break;
+            default: break;
+        }
+    }
+
+    bool operator==(const SgrState& other) const {
+        return bold == other.bold && italic == other.italic && underline == other.underline && strikethrough == other.strikethrough &&
+               hasForeground == other.hasForeground && hasBackground == other.hasBackground && foreground == other.foreground && background == other.background;
+    }
+    bool operator!=(const SgrState& other) const { return !(*this == other); }
+
+    // 从 from 切换到当前状态所需的 SGR，合并为一条序列; 有属性需要关闭时先以参数 0 重置
+    void appendTransition(std::string& out, const SgrState& from) const {
+        if (*this == from) return;
+        const bool reset = (from.bold && !bold) || (from.italic && !italic) || (from.underline && !underline) || (from.strikethrough && !strikethrough) ||
+                           (from.hasForeground && !hasForeground) || (from.hasBackground && !hasBackground);
+        appendSequence(out, reset ? SgrState() : from, reset);
+    }
+
+    // 从任意状态恢复到当前状态所需的字节
+    void appendRestore(std::string& out) const { appendSequence(out, SgrState(), true); }
+
+private:
+    void appendSequence(std::string& out, const SgrState& base, bool reset) const {
+        out += "\033[";
+        const size_t start = out.size();
+        auto param = [&](const char* text) {
+            if (out.size() != start) out += ';';
+            out += text;
+        };
+        if (reset) param("0");
+        if (bold && !base.bold) param("1");
+        if (italic && !base.italic) param("3");
+        if (underline && !base.underline) param("4");
+        if (strikethrough && !base.strikethrough) param("9");
+        if (hasForeground && (!base.hasForeground || base.foreground != foreground)) {
+            param("");
+            ColorMapper::appendParams(out, false, foreground);
+        }
+        if (hasBackground && (!base.hasBackground || base.background != background)) {
+            param("");
+            ColorMapper::appendParams(out, true, background);
+        }
+        out += 'm';
+    }
+};
+
+// 播放的最小单位: 时间戳相同的一串连续动作合并为一个 tick，其字节已首尾相接，播放时只需一次等待和一次写出
+// 含清屏的 tick 还记录最后一次清屏在 bytes 中的位置，以及清屏前一刻的 SGR 状态: 输出积压时，
+// 清屏之前尚未写出的字节都会被覆盖，可以整体丢弃，只需先用 restore 补上被丢掉的样式与颜色。
+struct TickRef {
+    static constexpr size_t NO_CLEAR = std::string_view::npos;
+
+    std::chrono::milliseconds timestamp;
+    int sourceLine = 0; // tick 中第一个动作所在的行
+    std::string_view bytes;
+    size_t clearOffset = NO_CLEAR;
+    std::string_view restore;
+};
+
+// 一张动作表的渲染结果: 全部字节连续存放，ticks_ 记录每个 tick 的起点
+class RenderedTicks {
+public:
+    void beginTick(std::chrono::milliseconds timestamp, int sourceLine) { ticks_.push_back({timestamp.count(), bytes_.size(), sourceLine, NO_CLEAR, 0, 0}); }
+    std::string& buffer() { return bytes_; } // 当前 tick 的字节追加在末尾
+
+    // 标记当前 tick 在此处清屏，restore 为清屏前一刻的 SGR 状态
+    void markClear(const SgrState& restore) {
+        Tick& tick = ticks_.back();
+        tick.clearOffset = static_cast<uint32_t>(bytes_.size() - tick.begin);
+        tick.restoreBegin = static_cast<uint32_t>(restores_.size());
+        restore.appendRestore(restores_);
+        tick.restoreLength = static_cast<uint32_t>(restores_.size() - tick.restoreBegin);
+    }
+
+    void clear() {
+        bytes_.clear();
+        restores_.clear();
+        ticks_.clear();
+    }
+
+    TickRef tick(size_t index) const {
+        const Tick& tick = ticks_[index];
+        const size_t end = index + 1 < ticks_.size() ? ticks_[index + 1].begin : bytes_.size();
+        TickRef ref{std::chrono::milliseconds(tick.timestampMs), tick.sourceLine, std::string_view(bytes_).substr(tick.begin, end - tick.begin)};
+        if (tick.clearOffset != NO_CLEAR) {
+            ref.clearOffset = tick.clearOffset;
+            ref.restore = std::string_view(restores_).substr(tick.restoreBegin, tick.restoreLength);
+        }
+        return ref;
+    }
+    size_t size() const { return ticks_.size(); }
+    size_t byteCount() const { return bytes_.size(); }
+    std::chrono::milliseconds lastTimestamp() const { return std::chrono::milliseconds(ticks_.back().timestampMs); }
+
+private:
+    struct Tick {
+        int64_t timestampMs;
+        uint64_t begin;
+        int32_t sourceLine;
+        uint32_t clearOffset;
+        uint32_t restoreBegin;
+        uint32_t restoreLength;
+    };
+    static constexpr uint32_t NO_CLEAR = UINT32_MAX;
+
+    std::string bytes_;
+    std::string restores_;
+    std::vector<Tick> ticks_;
+};
+
+// 渲染器: 把动作逐个追加到当前 tick，并在 tick 结束时补上需要的字节。状态跨 tick、跨行延续。
+class Renderer {
+public:
+    virtual ~Renderer() = default;
+    virtual void apply(const ActionRef& action, RenderedTicks& out) = 0;
+    virtual void endTick(RenderedTicks& out) { (void)out; }
+
+    // 跳转播放位置用 (见 SeekIndex): 复制渲染器在 tick 边界上的状态，以及渲染器认为终端此刻所处的 SGR 状态
+    virtual std::unique_ptr<Renderer> clone() const = 0;
+    virtual const SgrState& terminalSgr() const = 0;
+};
+
+// 按动作顺序输出。样式与颜色动作只更新目标 SGR 状态，等到下一个受它影响的输出 (文本、换行或清屏) 之前
+// 才与终端的实际状态比较，合并为一条序列写出; 不改变有效状态的转义 (重复的 [bold]、相同的 [color] 等) 不会输出。
+class DirectRenderer : public Renderer {
+public:
+    DirectRenderer(const std::string& username, ColorDepth depth) : username_(username), colors_(depth) {}
+
+    void apply(const ActionRef& action, RenderedTicks& out) override {
+        if (isSgrAction(action.type())) {
+            wanted_.apply(action, colors_);
+            return;
+        }
+        if (action.type() != CommandType::MOVE_CURSOR) { // 光标移动不受 SGR 影响
+            wanted_.appendTransition(out.buffer(), shown_);
+            shown_ = wanted_;
+        }
+        if (action.type() == CommandType::CLEAR_SCREEN) out.markClear(shown_);
+        renderAction(action, username_, out.buffer());
+    }
+
+    std::unique_ptr<Renderer> clone() const override { return std::make_unique<DirectRenderer>(*this); }
+    const SgrState& terminalSgr() const override { return shown_; }
+
+private:
+    std::string username_;
+    ColorMapper colors_;
+    SgrState wanted_; // 脚本要求的状态
+    SgrState shown_;  // 终端上的实际状态
+};
+
+// 渲染一张动作表，时间戳相同的连续动作归入同一个 tick
+void renderTicks(const ActionTable& actions, Renderer& renderer, RenderedTicks& out) {
+    out.clear();
+    for (size_t i = 0; i < actions.size(); ++i) {
+        const ActionRef action{&actions, i};
+        if (out.size() == 0 || out.lastTimestamp() != action.timestamp()) {
+            if (out.size() != 0) renderer.endTick(out);
+            out.beginTick(action.timestamp(), action.sourceLine());
+        }
+        renderer.apply(action, out);
+    }
+    if (out.size() != 0) renderer.endTick(out);
+}
+
+// --- 虚拟屏幕与差分渲染 ---
+// ScreenRenderer 在内存中维护一张字符格网格 (字形 + SGR 属性)，按终端的语义执行文本、换行、[mv] 与 [clear]，
+// 每个 tick 结束时与终端上实际显示的内容比较，只输出变化了的格子，并选用最短的光标移动方式 (ncurses 的双缓冲模型)。
+// 前提是播放期间终端尺寸不变。
+
+// 取终端尺寸; 标准输出不是终端时使用 80x24
+void terminalSize(int& rows, int& cols) {
+    rows = 24;
+    cols = 80;
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) {
+        rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+        cols = info.srWindow.Right - info.srWindow.Left + 1;
+    }
+#else
+    winsize size{};
+    if (::ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0) {
+        rows = size.ws_row;
+        cols = size.ws_col;
+    }
 #endif
+}
+
+// 解码 text[pos] 处的一个 UTF-8 字符，返回其字节数; 非法字节按单字节的 U+FFFD 处理
+size_t decodeUtf8(std::string_view text, size_t pos, char32_t& codepoint) {
+    const unsigned char lead = static_cast<unsigned char>(text[pos]);
+    const size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+    if (length == 0 || pos + length > text.size()) {
+        codepoint = 0xFFFD;
+        return 1;
+    }
+    codepoint = length == 1 ? lead : lead & (0x7F >> length);
+    for (size_t i = 1; i < length; ++i) {
+        const unsigned char next = static_cast<unsigned char>(text[pos + i]);
+        if ((next & 0xC0) != 0x80) {
+            codepoint = 0xFFFD;
+            return 1;
+        }
+        codepoint = (codepoint << 6) | (next & 0x3F);
+    }
+    return length;
+}
+
+struct CodepointRange { char32_t first, last; };
+
+// 组合字符与零宽字符 (按起点排序)
+constexpr CodepointRange ZERO_WIDTH_RANGES[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A}, {0x064B, 0x065F}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A},
+    {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x20D0, 0x20FF}, {0x302A, 0x302D}, {0x3099, 0x309A},
+    {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xE0100, 0xE01EF},
+};
+
+// 东亚宽字符、全角字符与常见 emoji，占两格 (按起点排序)
+constexpr CodepointRange WIDE_RANGES[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE},
+    {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE},
+    {0x26C4, 0x26C5}, {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5}, {0x26FA, 0x26FA},
+    {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+    {0x2E80, 0x3029}, {0x302E, 0x303E}, {0x3041, 0x3098}, {0x309B, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+    {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6},
+    {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F251}, {0x1F300, 0x1F64F},
+    {0x1F680, 0x1F6FF}, {0x1F900, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x3FFFD},
+};
+
+template <size_t N>
+bool inRanges(const CodepointRange (&ranges)[N], char32_t codepoint) {
+    const CodepointRange* it = std::upper_bound(ranges, ranges + N, codepoint, [](char32_t value, const CodepointRange& range) { return value < range.first; });
+    return it != ranges && codepoint <= (it - 1)->last;
+}
+
+// 字符在终端上占的列数 (简化的 wcwidth)
+int glyphWidth(char32_t codepoint) {
+    if (inRanges(ZERO_WIDTH_RANGES, codepoint)) return 0;
+    if (inRanges(WIDE_RANGES, codepoint)) return 2;
+    return 1;
+}
+
+// 网格中的一格。宽字符占两格，右半格 length 为 0，输出时随左半格一起写出。
+struct Cell {
+    static constexpr size_t MAX_GLYPH = 12; // 基本字符加上少量组合字符
+
+    char glyph[MAX_GLYPH] = {' '};
+    uint8_t length = 1;
+    uint8_t width = 1;
+    SgrState attr;
+
+    bool operator==(const Cell& other) const { return length == other.length && width == other.width && attr == other.attr && std::memcmp(glyph, other.glyph, length) == 0; }
+    std::string_view text() const { return std::string_view(glyph, length); }
+
+    // 擦除得到的空白格只保留背景色 (与终端的 bce 行为一致)
+    static Cell blank(const SgrState& current) {
+        Cell cell;
+        cell.attr.hasBackground = current.hasBackground;
+        cell.attr.background = current.background;
+        return cell;
+    }
+};
+
+class ScreenRenderer : public Renderer {
+public:
+    ScreenRenderer(const std::string& username, int rows, int cols, ColorDepth depth)
+        : username_(username), colors_(depth), rows_(std::max(rows, 1)), cols_(std::max(cols, 2)),
+          cells_(static_cast<size_t>(rows_) * cols_), shown_(cells_.size()), dirty_(rows_, 0) {
+        // showPrompt() 已经清屏并写出了第一个提示符
+        putText(username_);
+        putText("> ");
+        shown_ = cells_;
+        shownTop_ = top_;
+        std::fill(dirty_.begin(), dirty_.end(), 0);
+        scrolls_ = 0;
+        physRow_ = row_;
+        physCol_ = col_;
+        physWrap_ = wrap_;
+    }
+
+    void apply(const ActionRef& action, RenderedTicks& out) override {
+        (void)out;
+        switch (action.type()) {
+            case CommandType::PRINT_TEXT: putText(action.text()); break;
+            case CommandType::NEWLINE:
+                newline();
+                putText(username_);
+                putText("> ");
+                break;
+            case CommandType::NEWLINE_NO_PROMPT: newline(); break;
+            case CommandType::CLEAR_SCREEN: clearScreen(); break;
+            case CommandType::MOVE_CURSOR:
+                row_ = std::clamp(action.cursorRow() - 1, 0, rows_ - 1);
+                col_ = std::clamp(action.cursorCol() - 1, 0, cols_ - 1);
+                wrap_ = false;
+                break;
+            default: sgr_.apply(action, colors_); break;
+        }
+    }
+
+    void endTick(RenderedTicks& out) override {
+        std::string& bytes = out.buffer();
+        if (cleared_ && clearIsCheaper()) {
+            // 清屏之后的内容只依赖本 tick 自己的字节，积压时之前的输出都可以丢弃
+            out.markClear(physSgr_);
+            clearAttr_.appendTransition(bytes, physSgr_);
+            physSgr_ = clearAttr_;
+            bytes += "\033[2J\033[H";
+            std::fill(shown_.begin(), shown_.end(), Cell::blank(clearAttr_));
+            physRow_ = physCol_ = 0;
+            physWrap_ = false;
+            physValid_ = true;
+            scrolls_ = 0;
+        }
+        cleared_ = false;
+        if (scrolls_ > 0) emitScroll(bytes);
+        emitChanges(bytes);
+    }
+
+    std::unique_ptr<Renderer> clone() const override { return std::make_unique<ScreenRenderer>(*this); }
+
+    // 清屏后按目标画面整屏重画，光标位置与延迟换行状态一并重现。只在 tick 边界上调用。
+    void repaint(std::string& bytes) {
+        bytes += "\033[0m\033[2J\033[H";
+        physSgr_ = SgrState();
+        physRow_ = physCol_ = 0;
+        physWrap_ = false;
+        physValid_ = true;
+        shownTop_ = top_;
+        std::fill(shown_.begin(), shown_.end(), Cell());
+        std::fill(dirty_.begin(), dirty_.end(), 1);
+        emitChanges(bytes);
+    }
+
+    const SgrState& terminalSgr() const override { return physSgr_; }
+
+private:
+    static constexpr int TAB_WIDTH = 8;
+
+    // 写出 dirty 行中与终端不同的格子，再把光标移到目标位置
+    void emitChanges(std::string& bytes) {
+        for (int r = 0; r < rows_; ++r) {
+            if (!dirty_[storageRow(top_, r)]) continue;
+            dirty_[storageRow(top_, r)] = 0;
+            for (int c = 0; c < cols_;) {
+                if (cell(r, c) == shownCell(r, c)) {
+                    ++c;
+                    continue;
+                }
+                // 宽字符的右半格变化时从左半格开始写
+                c = emitCell(bytes, r, cell(r, c).length == 0 && c > 0 ? c - 1 : c);
+            }
+        }
+        if (wrap_) {
+            // 光标停在行尾且处于延迟换行状态: 重写最后一格来重现这一状态
+            if (!(physValid_ && physWrap_ && physRow_ == row_)) emitCell(bytes, row_, cell(row_, cols_ - 1).length == 0 ? cols_ - 2 : cols_ - 1);
+        } else {
+            moveTo(bytes, row_, col_);
+        }
+    }
+
+    // 滚屏通过移动行起点实现，逻辑行 r 存放在 (top + r) % rows_
+    size_t storageRow(int top, int r) const { return static_cast<size_t>((top + r) % rows_); }
+    Cell& cell(int r, int c) { return cells_[storageRow(top_, r) * cols_ + c]; }
+    Cell& shownCell(int r, int c) { return shown_[storageRow(shownTop_, r) * cols_ + c]; }
+    void markDirty(int r) { dirty_[storageRow(top_, r)] = 1; }
+
+    void putText(std::string_view text) {
+        for (size_t pos = 0; pos < text.size();) {
+            char32_t codepoint;
+            const size_t length = decodeUtf8(text, pos, codepoint);
+            const std::string_view glyph = text.substr(pos, length);
+            pos += length;
+            if (codepoint == '\n') {
+                newline(); // 终端的 onlcr 会把 \n 变成 \r\n
+            } else if (codepoint == '\r') {
+                col_ = 0;
+                wrap_ = false;
+            } else if (codepoint == '\t') {
+                if (!wrap_) col_ = std::min(cols_ - 1, (col_ / TAB_WIDTH + 1) * TAB_WIDTH);
+            } else if (codepoint >= 0x20 && codepoint != 0x7F) {
+                putGlyph(glyph, glyphWidth(codepoint)); // 其余控制字符不占位置
+            }
+        }
+    }
+
+    void putGlyph(std::string_view glyph, int width) {
+        if (width == 0) {
+            // 组合字符附加到前一个字形上
+            const int c = wrap_ ? col_ : col_ - 1;
+            if (c < 0) return;
+            Cell* target = &cell(row_, c);
+            if (target->length == 0 && c > 0) target = &cell(row_, c - 1);
+            if (target->length + glyph.size() > Cell::MAX_GLYPH) return;
+            std::memcpy(target->glyph + target->length, glyph.data(), glyph.size());
+            target->length = static_cast<uint8_t>(target->length + glyph.size());
+            markDirty(row_);
+            return;
+        }
+        if (wrap_) {
+            col_ = 0;
+            wrap_ = false;
+            lineFeed();
+        }
+        if (width == 2 && col_ == cols_ - 1) {
+            // 行尾只剩一格时宽字符整体移到下一行
+            col_ = 0;
+            lineFeed();
+        }
+        breakWide(row_, col_);
+        if (width == 2) breakWide(row_, col_ + 1);
+        Cell& target = cell(row_, col_);
+        std::memcpy(target.glyph, glyph.data(), glyph.size());
+        target.length = static_cast<uint8_t>(glyph.size());
+        target.width = static_cast<uint8_t>(width);
+        target.attr = sgr_;
+        if (width == 2) {
+            Cell& right = cell(row_, col_ + 1);
+            right.length = 0;
+            right.width = 0;
+            right.attr = sgr_;
+        }
+        markDirty(row_);
+        col_ += width;
+        if (col_ >= cols_) {
+            col_ = cols_ - 1;
+            wrap_ = true;
+        }
+    }
+
+    // 覆盖宽字符的一半时，另一半变为空白
+    void breakWide(int r, int c) {
+        const Cell& target = cell(r, c);
+        if (target.length == 0 && c > 0) cell(r, c - 1) = Cell::blank(cell(r, c - 1).attr);
+        else if (target.width == 2 && c + 1 < cols_) cell(r, c + 1) = Cell::blank(cell(r, c + 1).attr);
+    }
+
+    void newline() {
+        col_ = 0;
+        wrap_ = false;
+        lineFeed();
+    }
+
+    void lineFeed() {
+        if (row_ + 1 < rows_) {
+            ++row_;
+            return;
+        }
+        // 在最后一行换行: 整屏上移一行，新的一行以当前背景色填充
+        const size_t bottom = storageRow(top_, 0);
+        top_ = (top_ + 1) % rows_;
+        std::fill(cells_.begin() + bottom * cols_, cells_.begin() + (bottom + 1) * cols_, Cell::blank(sgr_));
+        dirty_[bottom] = 1;
+        ++scrolls_;
+    }
+
+    void clearScreen() {
+        clearAttr_ = Cell::blank(sgr_).attr;
+        std::fill(cells_.begin(), cells_.end(), Cell::blank(sgr_));
+        std::fill(dirty_.begin(), dirty_.end(), 1);
+        row_ = col_ = 0;
+        wrap_ = false;
+        cleared_ = true;
+        scrolls_ = 0;
+    }
+
+    // 本 tick 清过屏时，比较真正清屏后重画与直接差分各需改写的格子数。画面大体不变的逐帧重绘走差分更省。
+    bool clearIsCheaper() {
+        const Cell blank = Cell::blank(clearAttr_);
+        size_t repaint = 0;
+        size_t changed = 0;
+        for (int r = 0; r < rows_; ++r) {
+            for (int c = 0; c < cols_; ++c) {
+                const Cell& target = cell(r, c);
+                if (!(target == blank)) ++repaint;
+                if (!(target == shownCell(r, c))) ++changed;
+            }
+        }
+        return repaint < changed;
+    }
+
+    // 让终端也滚动同样的行数，未变化的行就不必重写
+    void emitScroll(std::string& bytes) {
+        if (physSgr_.hasBackground) {
+            // 滚入的新行先以默认背景出现，需要的背景色随差分补上
+            SgrState noBackground = physSgr_;
+            noBackground.hasBackground = false;
+            noBackground.background = 0;
+            noBackground.appendTransition(bytes, physSgr_);
+            physSgr_ = noBackground;
+        }
+        const int count = std::min(scrolls_, rows_);
+        if (!(physValid_ && physRow_ == rows_ - 1)) moveTo(bytes, rows_ - 1, 0);
+        bytes.append(static_cast<size_t>(count), '\n');
+        bytes += '\r'; // 终端是否把 \n 当作 \r\n 取决于 onlcr，补一个 \r 使光标列确定
+        physRow_ = rows_ - 1;
+        physCol_ = 0;
+        physWrap_ = false;
+        physValid_ = true;
+        for (int i = 0; i < count; ++i) {
+            const size_t bottom = storageRow(shownTop_, 0);
+            shownTop_ = (shownTop_ + 1) % rows_;
+            std::fill(shown_.begin() + bottom * cols_, shown_.begin() + (bottom + 1) * cols_, Cell());
+        }
+        scrolls_ = 0;
+    }
+
+    // 写出 (r, c) 处的一个字形，返回下一个待比较的列
+    int emitCell(std::string& bytes, int r, int c) {
+        moveTo(bytes, r, c);
+        const Cell& target = cell(r, c);
+        target.attr.appendTransition(bytes, physSgr_);
+        physSgr_ = target.attr;
+        bytes += target.length == 0 ? std::string_view(" ") : target.text();
+        shownCell(r, c) = target;
+        const int width = std::max<int>(target.width, 1);
+        if (width == 2 && c + 1 < cols_) shownCell(r, c + 1) = cell(r, c + 1);
+        physCol_ = c + width;
+        if (physCol_ >= cols_) {
+            physCol_ = cols_ - 1;
+            physWrap_ = true;
+        }
+        return c + width;
+    }
+
+    // 把终端光标移到 (r, c)，在几种移动方式中选最短的
+    void moveTo(std::string& bytes, int r, int c) {
+        if (physValid_ && !physWrap_ && physRow_ == r) {
+            if (physCol_ == c) return;
+            if (c > physCol_) {
+                const int gap = c - physCol_;
+                if (gap <= 3 && canRewrite(r, physCol_, c)) {
+                    // 间隔很短且中间的格子已正确显示时，重写它们比移动光标更短
+                    for (int i = physCol_; i < c; ++i) bytes += cell(r, i).text();
+                } else {
+                    bytes += "\033[";
+                    if (gap > 1) appendInt(bytes, gap);
+                    bytes += 'C';
+                }
+                physCol_ = c;
+                return;
+            }
+            if (c == 0) {
+                bytes += '\r';
+                physCol_ = 0;
+                return;
+            }
+        }
+        if (physValid_ && !physWrap_ && r == physRow_ + 1 && c == 0) {
+            bytes += "\r\n";
+        } else {
+            bytes += "\033[";
+            if (r != 0 || c != 0) appendInt(bytes, r + 1);
+            if (c != 0) {
+                bytes += ';';
+                appendInt(bytes, c + 1);
+            }
+            bytes += 'H';
+        }
+        physRow_ = r;
+        physCol_ = c;
+        physWrap_ = false;
+        physValid_ = true;
+    }
+
+    bool canRewrite(int r, int from, int to) {
+        for (int i = from; i < to; ++i) {
+            const Cell& target = cell(r, i);
+            if (target.width != 1 || target.length == 0 || target.attr != physSgr_ || !(target == shownCell(r, i))) return false;
+        }
+        return true;
+    }
+
+    std::string username_;
+    ColorMapper colors_;
+    int rows_;
+    int cols_;
+    std::vector<Cell> cells_;      // 按脚本语义得到的目标画面
+    std::vector<Cell> shown_;      // 终端上当前显示的画面
+    std::vector<uint8_t> dirty_;   // 按 cells_ 的存储行记录本 tick 内被改动过的行
+    int top_ = 0;
+    int shownTop_ = 0;
+
+    // 目标画面的光标与属性
+    int row_ = 0;
+    int col_ = 0;
+    bool wrap_ = false;            // 写满最后一列后的延迟换行状态
+    SgrState sgr_;
+    bool cleared_ = false;         // 本 tick 内是否清过屏
+    SgrState clearAttr_;
+    int scrolls_ = 0;              // 本 tick 内滚屏的行数
+
+    // 终端上实际的光标与属性
+    int physRow_ = 0;
+    int physCol_ = 0;
+    bool physWrap_ = false;
+    bool physValid_ = true;
+    SgrState physSgr_;
+};
+
+enum class RenderMode { DIRECT, DIFF };
+
+std::unique_ptr<Renderer> makeRenderer(RenderMode mode, const std::string& username, ColorDepth depth) {
+    if (mode == RenderMode::DIFF) {
+        int rows = 0;
+        int cols = 0;
+        terminalSize(rows, cols);
+        return std::make_unique<ScreenRenderer>(username, rows, cols, depth);
+    }
+    return std::make_unique<DirectRenderer>(username, depth);
+}
+
+// --- 跳转索引 ---
+// 从时间轴中途开始播放时，需要先在终端上重现那一刻的画面、光标与 SGR。索引重放一遍动作表，
+// 每渲染出约 1 MiB 字节就在 tick 边界上保存一份状态快照 (渲染器本身，以及维护画面内容的 ScreenRenderer)。
+// 跳转时二分查找目标 tick 与它之前最近的快照，只需从快照重放不到 1 MiB 的动作，再整屏重画。
+class SeekIndex {
+public:
+    static constexpr size_t SNAPSHOT_BYTES = 1 << 20;
+
+    // renderer 必须是尚未渲染过任何动作的新渲染器，screen 与之使用相同的用户名与色深
+    SeekIndex(const ActionTable& actions, const RenderedTicks& rendered, const Renderer& renderer, const ScreenRenderer& screen)
+        : actions_(actions), rendered_(rendered) {
+        Snapshot current{0, renderer.clone(), std::make_unique<ScreenRenderer>(screen)};
+        // 第 0 个快照是初始状态: 跳回开头也要清掉屏幕上已有的内容并重画提示符
+        snapshots_.push_back({0, renderer.clone(), std::make_unique<ScreenRenderer>(screen)});
+        RenderedTicks scratch;
+        size_t pending = 0; // 上一份快照以来播放要写出的字节
+        for (size_t i = 0; i < actions.size(); ++i) {
+            const ActionRef action{&actions, i};
+            if (!tickStarts_.empty() && ActionRef{&actions, tickStarts_.back()}.timestamp() == action.timestamp()) {
+                current.renderer->apply(action, scratch);
+                current.screen->apply(action, scratch);
+                continue;
+            }
+            if (!tickStarts_.empty()) {
+                endTick(current, scratch);
+                pending += rendered.tick(tickStarts_.size() - 1).bytes.size();
+            }
+            if (!tickStarts_.empty() && pending >= SNAPSHOT_BYTES) {
+                snapshots_.push_back({tickStarts_.size(), current.renderer->clone(), std::make_unique<ScreenRenderer>(*current.screen)});
+                pending = 0;
+            }
+            tickStarts_.push_back(i);
+            scratch.clear();
+            scratch.beginTick(action.timestamp(), action.sourceLine());
+            current.renderer->apply(action, scratch);
+            current.screen->apply(action, scratch);
+        }
+        tickStarts_.push_back(actions.size());
+    }
+
+    // 从 position 开始播放: 追加重现那一刻终端状态的字节，返回第一个不早于 position 的 tick
+    size_t seek(std::chrono::milliseconds position, std::string& out) const {
+        size_t first = 0;
+        size_t count = rendered_.size();
+        while (count > 0) {
+            const size_t half = count / 2;
+            if (rendered_.tick(first + half).timestamp < position) {
+                first += half + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
+        }
+        const auto snapshot = std::upper_bound(snapshots_.begin(), snapshots_.end(), first, [](size_t tick, const Snapshot& s) { return tick < s.tick; }) - 1;
+        Snapshot current{snapshot->tick, snapshot->renderer->clone(), std::make_unique<ScreenRenderer>(*snapshot->screen)};
+        RenderedTicks scratch;
+        for (size_t tick = current.tick; tick < first; ++tick) {
+            scratch.clear();
+            scratch.beginTick(rendered_.tick(tick).timestamp, 0);
+            for (size_t i = tickStarts_[tick]; i < tickStarts_[tick + 1]; ++i) {
+                current.renderer->apply(ActionRef{&actions_, i}, scratch);
+                current.screen->apply(ActionRef{&actions_, i}, scratch);
+            }
+            endTick(current, scratch);
+        }
+        // 重画之后光标已在原处，只差 SGR 要切换到后续 tick 的字节所假定的状态
+        current.screen->repaint(out);
+        current.renderer->terminalSgr().appendTransition(out, current.screen->terminalSgr());
+        return first;
+    }
+
+    size_t snapshotCount() const { return snapshots_.size(); }
+
+private:
+    struct Snapshot {
+        size_t tick; // 快照为该 tick 开始之前的状态
+        std::unique_ptr<Renderer> renderer;
+        std::unique_ptr<ScreenRenderer> screen;
+    };
+
+    static void endTick(Snapshot& state, RenderedTicks& scratch) {
+        state.renderer->endTick(scratch);
+        state.screen->endTick(scratch);
+    }
+
+    const ActionTable& actions_;
+    const RenderedTicks& rendered_;
+    std::vector<size_t> tickStarts_; // 每个 tick 的第一个动作，末尾附加动作总数
+    std::vector<Snapshot> snapshots_;
+};
+
+bool startsWith(std::string_view str, std::string_view prefix) {
+    return str.substr(0, prefix.size()) == prefix;
+}
+
+// 只读内存映射文件。映射失败时退回到一次性读入内存。
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size)) { close(); return false; }
+        size_ = static_cast<size_t>(size.QuadPart);
+        if (size_ == 0) return true;
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping_ != NULL) data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ == 0) { ::close(fd); return true; }
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p != MAP_FAILED) {
+            data_ = static_cast<const char*>(p);
+            mapped_ = true;
+            madvise(p, size_, MADV_SEQUENTIAL);
+        }
+#endif
+        if (data_ == nullptr) {
+            // 无法映射 (例如管道或特殊文件系统)，读入内存作为后备
+            std::ifstream in(path, std::ios::binary);
+            if (!in.is_open()) { close(); return false; }
+            fallback_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            data_ = fallback_.data();
+            size_ = fallback_.size();
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data_ != nullptr && fallback_.empty()) UnmapViewOfFile(data_);
+        if (mapping_ != NULL) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        mapping_ = NULL; file_ = INVALID_HANDLE_VALUE;
+#else
+        if (mapped_) munmap(const_cast<char*>(data_), size_);
+        mapped_ = false;
+#endif
+        data_ = nullptr; size_ = 0;
+        fallback_.clear();
+    }
+
+    std::string_view view() const { return data_ == nullptr ? std::string_view() : std::string_view(data_, size_); }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    std::string fallback_;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = NULL;
+#else
+    bool mapped_ = false;
+#endif
+};
+
+// 解析结果。文本载荷驻留在 actions 的文本池中，默认是指向映射区的视图，只有转义改写过的片段才会被复制。
+// rendered 在播放前由 actions 预渲染得到; 只做编译时不需要它。
+struct Script {
+    MappedFile source;
+    ActionTable actions;
+    RenderedTicks rendered;
+    std::string username = "user@cliplayer";
+};
+
+// 终端控制函数
+void enableAnsiSupport() {
+#ifdef _WIN32
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE); if (hOut == INVALID_HANDLE_VALUE) return;
+    DWORD dwMode = 0; if (!GetConsoleMode(hOut, &dwMode)) return;
+    dwMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING; SetConsoleMode(hOut, dwMode);
+#endif
+}
+
+// 音乐在加载时只打开不播放，等脚本解析完、画面准备好后再由 start() 开始，二者从同一时刻起步。
+// 构造 (打开设备、预先解码开头) 在后台线程上与脚本解析同时进行，因此警告先存入 warning，由主线程输出。
+struct AudioPlayer {
+    ma_engine engine;
+    ma_sound sound;
+    bool initialized = false;
+    std::string warning;
+
+    AudioPlayer(const std::string& music_path) {
+        ma_result result = ma_engine_init(NULL, &engine);
+        if(result != MA_SUCCESS) {
+            warning = "警告: 初始化音频引擎失败, code: " + std::to_string(result);
+            return;
+        }
+
+        // 以流的方式打开: 初始化时先解码好开头的两页，之后由资源管理器的后台线程提前解码，音频线程只需混音。
+        // 整首解码 (MA_SOUND_FLAG_DECODE) 对几分钟的曲目要花上百毫秒，比解析脚本还慢，反而推迟了第一帧
+        result = ma_sound_init_from_file(&engine, music_path.c_str(), MA_SOUND_FLAG_STREAM, NULL, NULL, &sound);
+        if(result != MA_SUCCESS) {
+            warning = "警告: 打开音频文件 '" + music_path + "' 失败, code: " + std::to_string(result);
+            ma_engine_uninit(&engine); // 引擎初始化成功但打开文件失败，需要清理
+            return;
+        }
+
+        initialized = true;
+    }
+
+    ~AudioPlayer() {
+        if (initialized) {
+            ma_sound_uninit(&sound);
+            ma_engine_uninit(&engine);
+            std::cout << "音频引擎已关闭。" << std::endl;
+        }
+    }
+
+    // 让音乐以 speed 倍速从 from 处、在引擎时间轴上两个周期之后的确定帧开始 (避开正在混音的周期)，并等到设备确实在取数据才返回。
+    // 倍速通过 pitch 实现 (重采样，音调随之升降)。设备迟迟不取数据时返回 false，此时音乐照常播放，但不宜再作为主时钟。
+    // 暂停、跳转或变速之后也经由这里从新的位置重新开始。
+    bool start(std::chrono::milliseconds from, double speed) {
+        ma_sound_stop(&sound);
+        ma_uint32 soundRate = 0;
+        if (ma_sound_get_data_format(&sound, NULL, NULL, &soundRate, NULL, 0) == MA_SUCCESS) {
+            ma_sound_seek_to_pcm_frame(&sound, static_cast<ma_uint64>(from.count()) * soundRate / 1000);
+        }
+        offset_ = from;
+        speed_ = speed;
+        ma_sound_set_pitch(&sound, static_cast<float>(speed));
+        const ma_uint32 rate = ma_engine_get_sample_rate(&engine);
+        const ma_device* device = ma_engine_get_device(&engine);
+        ma_uint64 period = rate / 100;
+        latency_ = std::chrono::milliseconds(0);
+        if (device != nullptr && device->playback.internalSampleRate != 0) {
+            period = static_cast<ma_uint64>(device->playback.internalPeriodSizeInFrames) * rate / device->playback.internalSampleRate;
+            latency_ = std::chrono::nanoseconds(static_cast<int64_t>(device->playback.internalPeriodSizeInFrames) * device->playback.internalPeriods * 1000000000LL / device->playback.internalSampleRate);
+        }
+        startFrame_ = ma_engine_get_time_in_pcm_frames(&engine) + 2 * period;
+        ma_sound_set_start_time_in_pcm_frames(&sound, startFrame_);
+        if (ma_sound_start(&sound) != MA_SUCCESS) return false;
+
+        const auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (ma_engine_get_time_in_pcm_frames(&engine) <= startFrame_) {
+            if (std::chrono::steady_clock::now() > giveUp) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    // 当前听到的音乐位置: 起点加上音乐开始以来引擎混出的帧数，减去仍在设备缓冲中尚未播出的部分，再按倍速换算为音乐时间。
+    // 引擎时间每个周期才前进一次，读数最多比实际晚一个周期。
+    std::chrono::nanoseconds position() const {
+        const ma_uint64 now = ma_engine_get_time_in_pcm_frames(&engine);
+        const int64_t frames = static_cast<int64_t>(now) - static_cast<int64_t>(startFrame_);
+        const auto played = std::chrono::nanoseconds(frames * 1000000000LL / ma_engine_get_sample_rate(&engine)) - latency_;
+        return offset_ + std::chrono::nanoseconds(static_cast<int64_t>(static_cast<double>(played.count()) * speed_));
+    }
+
+    void pause() { ma_sound_stop(&sound); }
+
+    std::chrono::nanoseconds latency() const { return latency_; }
+
+private:
+    ma_uint64 startFrame_ = 0;
+    std::chrono::nanoseconds offset_{0};
+    double speed_ = 1.0;
+    std::chrono::nanoseconds latency_{0};
+};
+
+// --- 输出后端 ---
+// 播放输出不经过 std::cout: 字节先进入后端自己的缓冲区，每个 tick 结束时一次性写往标准输出。
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+    virtual void write(std::string_view bytes) = 0; // 追加到当前 tick
+    virtual void flush() = 0;                       // 结束当前 tick，写出已追加的字节
+    virtual void finish() { flush(); }              // 播放结束: 保证所有字节都已写出
+    virtual void writeTick(const TickRef& tick) {
+        write(tick.bytes);
+        flush();
+    }
+
+    uint64_t bytesWritten() const { return bytesWritten_; }
+    uint64_t syscalls() const { return syscalls_; }
+    uint64_t collapsedBytes() const { return collapsedBytes_; } // 积压时因被清屏覆盖而丢弃的字节
+
+protected:
+    uint64_t bytesWritten_ = 0;
+    uint64_t syscalls_ = 0;
+    uint64_t collapsedBytes_ = 0;
+};
+
+// 直接写文件描述符 1 (Windows 上为标准输出句柄)。小片段复制进 64 字节对齐的缓冲区，
+// 大片段 (通常是整个 tick 的预渲染字节) 不复制，与缓冲区中已有的内容一起用一次 writev 写出。
+class FdOutput : public OutputSink {
+public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+    static constexpr size_t DIRECT_THRESHOLD = 4 * 1024;
+
+    void write(std::string_view bytes) override {
+        if (bytes.size() >= DIRECT_THRESHOLD) {
+            writeAll(std::string_view(buffer_, used_), bytes);
+            used_ = 0;
+            return;
+        }
+        if (used_ + bytes.size() > BUFFER_SIZE) flush();
+        std::memcpy(buffer_ + used_, bytes.data(), bytes.size());
+        used_ += bytes.size();
+    }
+
+    void flush() override {
+        if (used_ == 0) return;
+        writeAll(std::string_view(buffer_, used_), {});
+        used_ = 0;
+    }
+
+private:
+    // 依次写完 head 与 tail，处理部分写入与 EINTR。写出失败 (例如管道已关闭) 后丢弃之后的输出，与 std::cout 进入错误状态后的表现一致。
+    void writeAll(std::string_view head, std::string_view tail) {
+        bytesWritten_ += head.size() + tail.size();
+#ifdef _WIN32
+        const HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
+        for (std::string_view part : {head, tail}) {
+            while (!failed_ && !part.empty()) {
+                DWORD written = 0;
+                ++syscalls_;
+                if (!WriteFile(handle, part.data(), static_cast<DWORD>(std::min<size_t>(part.size(), 1u << 30)), &written, nullptr)) failed_ = true;
+                part.remove_prefix(written);
+            }
+        }
+#else
+        iovec parts[2];
+        int count = 0;
+        for (std::string_view part : {head, tail}) {
+            if (!part.empty()) parts[count++] = {const_cast<char*>(part.data()), part.size()};
+        }
+        iovec* next = parts;
+        while (!failed_ && count > 0) {
+            ++syscalls_;
+            ssize_t written = ::writev(STDOUT_FILENO, next, count);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    // 继承来的标准输出可能处于非阻塞模式，等到可写再继续
+                    pollfd target = {STDOUT_FILENO, POLLOUT, 0};
+                    ::poll(&target, 1, -1);
+                    continue;
+                }
+                failed_ = true;
+                break;
+            }
+            // 部分写入: 跳过已写完的段，并把当前段的起点后移
+            while (count > 0 && static_cast<size_t>(written) >= next->iov_len) {
+                written -= static_cast<ssize_t>(next->iov_len);
+                ++next;
+                --count;
+            }
+            if (count > 0) {
+                next->iov_base = static_cast<char*>(next->iov_base) + written;
+                next->iov_len -= static_cast<size_t>(written);
+            }
+        }
+#endif
+    }
+
+    alignas(64) char buffer_[BUFFER_SIZE];
+    size_t used_ = 0;
+    bool failed_ = false;
+};
+
+#ifndef _WIN32
+// 非阻塞输出: 标准输出设为 O_NONBLOCK，终端来不及接收的字节留在队列里，播放线程不会因此阻塞而触发防超时。
+// 积压时遇到含清屏的 tick，队列中尚未开始写出的 tick 与本 tick 清屏之前的部分都会被清屏覆盖，直接丢弃，
+// 换成一段恢复 SGR 状态的字节。正在写出的 tick 必须写完，以免留下半条转义序列。
+class NonBlockingOutput : public OutputSink {
+public:
+    static constexpr size_t MAX_QUEUED = 8 * 1024 * 1024; // 积压超过此值时退化为阻塞等待，避免无限占用内存
+
+    NonBlockingOutput() {
+        flags_ = ::fcntl(STDOUT_FILENO, F_GETFL);
+        if (flags_ != -1) ::fcntl(STDOUT_FILENO, F_SETFL, flags_ | O_NONBLOCK);
+    }
+    ~NonBlockingOutput() override { finish(); }
+
+    void write(std::string_view bytes) override { queue_ += bytes; }
+
+    void flush() override {
+        if (tickEnds_.empty() ? end() > tickStart_ : end() > tickEnds_.back()) tickEnds_.push_back(end());
+        pump();
+        while (end() - written_ > MAX_QUEUED && !failed_) {
+            waitWritable();
+            pump();
+        }
+    }
+
+    // 写完队列后恢复阻塞模式: 文件状态与 shell 共享，终端上的标准错误通常也是同一个打开的文件
+    void finish() override {
+        flush();
+        while (written_ < end() && !failed_) {
+            waitWritable();
+            pump();
+        }
+        if (flags_ != -1) ::fcntl(STDOUT_FILENO, F_SETFL, flags_);
+        flags_ = -1;
+    }
+
+    void writeTick(const TickRef& tick) override {
+        std::string_view bytes = tick.bytes;
+        if (tick.clearOffset != TickRef::NO_CLEAR && written_ < end()) {
+            // 已开始写出的 tick 保留到结尾，之后的内容都被本次清屏覆盖
+            const uint64_t keep = (tickEnds_.empty() || written_ == tickStart_) ? written_ : tickEnds_.front();
+            collapsedBytes_ += end() - keep + tick.clearOffset;
+            queue_.resize(static_cast<size_t>(keep - base_));
+            while (!tickEnds_.empty() && tickEnds_.back() > keep) tickEnds_.pop_back();
+            queue_ += tick.restore;
+            bytes.remove_prefix(tick.clearOffset);
+        }
+        write(bytes);
+        flush();
+    }
+
+private:
+    // 以下偏移均为自开始以来追加到队列的绝对字节位置，queue_[0] 对应 base_
+    uint64_t end() const { return base_ + queue_.size(); }
+
+    // 在不阻塞的前提下尽量写出
+    void pump() {
+        while (written_ < end() && !failed_) {
+            ++syscalls_;
+            const ssize_t n = ::write(STDOUT_FILENO, queue_.data() + (written_ - base_), static_cast<size_t>(end() - written_));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) failed_ = true;
+                break;
+            }
+            written_ += static_cast<uint64_t>(n);
+            bytesWritten_ += static_cast<uint64_t>(n);
+        }
+        if (failed_) written_ = end();
+        while (!tickEnds_.empty() && tickEnds_.front() <= written_) {
+            tickStart_ = tickEnds_.front();
+            tickEnds_.pop_front();
+        }
+        if (written_ == end()) {
+            base_ = written_;
+            queue_.clear();
+        } else if (written_ - base_ >= 64 * 1024 && written_ - base_ >= queue_.size() / 2) {
+            queue_.erase(0, static_cast<size_t>(written_ - base_));
+            base_ = written_;
+        }
+    }
+
+    static void waitWritable() {
+        pollfd target = {STDOUT_FILENO, POLLOUT, 0};
+        ::poll(&target, 1, -1);
+    }
+
+    int flags_ = -1;
+    std::string queue_;
+    uint64_t base_ = 0;
+    uint64_t written_ = 0;
+    uint64_t tickStart_ = 0;          // 正在写出 (或下一个待写) 的 tick 的起点
+    std::deque<uint64_t> tickEnds_;   // 尚未写完的各 tick 的终点
+    bool failed_ = false;
+};
+#endif
+
+// 丢弃全部字节，只计数。用于不受终端速度影响地测量解析与预渲染的吞吐量
+class NullOutput : public OutputSink {
+public:
+    void write(std::string_view bytes) override { bytesWritten_ += bytes.size(); }
+    void flush() override {}
+};
+
+// 按命令行选择输出后端
+std::unique_ptr<OutputSink> makeOutput(bool nonblocking, bool discard) {
+    if (discard) return std::make_unique<NullOutput>();
+#ifdef _WIN32
+    if (nonblocking) std::cerr << "警告: Windows 控制台不支持非阻塞输出，将使用普通输出。" << std::endl;
+#else
+    if (nonblocking) return std::make_unique<NonBlockingOutput>();
+#endif
+    return std::make_unique<FdOutput>();
+}
+
+// 清屏并显示第一个提示符
+void showPrompt(OutputSink& out, const std::string& username) {
+    out.write("\033[2J\033[H\033[0m");
+    out.write(username);
+    out.write("> ");
+    out.flush();
+}
+
+// --- 结构字符扫描 (类似 simdjson 的 stage 1) ---
+// 以 64 字节为一块，一次性求出 '[' / ']' / '&' 的位掩码，再由掩码得到行内所有方括号的位置。
+// 前一个字节是 '&' 的方括号即为转义括号，用 STRUCTURAL_ESCAPED 标记。
+constexpr uint32_t STRUCTURAL_ESCAPED = 0x80000000u;
+
+struct BlockMasks { uint64_t open, close, amp; };
+using ClassifyBlockFn = BlockMasks (*)(const char* block);
+
+inline unsigned countTrailingZeros(uint64_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+    _BitScanForward64(&index, mask);
+#else
+    if (static_cast<uint32_t>(mask) != 0) _BitScanForward(&index, static_cast<uint32_t>(mask));
+    else { _BitScanForward(&index, static_cast<uint32_t>(mask >> 32)); index += 32; }
+#endif
+    return index;
+#else
+    return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
+}
+
+BlockMasks classifyBlockScalar(const char* block) {
+    BlockMasks m{0, 0, 0};
+    for (unsigned i = 0; i < 64; ++i) {
+        const uint64_t bit = uint64_t(1) << i;
+        switch (block[i]) {
+            case '[': m.open |= bit; break;
+            case ']': m.close |= bit; break;
+            case '&': m.amp |= bit; break;
+            default: break;
+        }
+    }
+    return m;
+}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CLIP_HAVE_X86_SIMD 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CLIP_TARGET(isa)
+#else
+#define CLIP_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+CLIP_TARGET("sse2") BlockMasks classifyBlockSse2(const char* block) {
+    const __m128i open = _mm_set1_epi8('['), close = _mm_set1_epi8(']'), amp = _mm_set1_epi8('&');
+    BlockMasks m{0, 0, 0};
+    for (unsigned i = 0; i < 4; ++i) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i * 16));
+        const unsigned shift = i * 16;
+        m.open |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, open)))) << shift;
+        m.close |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, close)))) << shift;
+        m.amp |= uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, amp)))) << shift;
+    }
+    return m;
+}
+
+CLIP_TARGET("avx2") inline uint64_t matchMaskAvx2(__m256i lo, __m256i hi, char ch) {
+    const __m256i needle = _mm256_set1_epi8(ch);
+    const uint64_t low = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle)));
+    const uint64_t high = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle)));
+    return low | (high << 32);
+}
+
+CLIP_TARGET("avx2") BlockMasks classifyBlockAvx2(const char* block) {
+    const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+    return {matchMaskAvx2(lo, hi, '['), matchMaskAvx2(lo, hi, ']'), matchMaskAvx2(lo, hi, '&')};
+}
+
+bool cpuSupportsAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool cpuSupportsSse2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+#endif
+
+// 可用的扫描实现，按优先级从高到低排列
+struct ScannerImpl { const char* name; ClassifyBlockFn classify; };
+
+std::vector<ScannerImpl> availableScanners() {
+    std::vector<ScannerImpl> impls;
+#ifdef CLIP_HAVE_X86_SIMD
+    if (cpuSupportsAvx2()) impls.push_back({"avx2", classifyBlockAvx2});
+    if (cpuSupportsSse2()) impls.push_back({"sse2", classifyBlockSse2});
+#endif
+    impls.push_back({"scalar", classifyBlockScalar});
+    return impls;
+}
+
+ScannerImpl& activeScanner() {
+    static ScannerImpl active = availableScanners().front();
+    return active;
+}
+
+// 按名称选择扫描实现 ("auto" 表示运行时自动选择最快的可用实现)
+bool selectScanner(std::string_view name) {
+    std::vector<ScannerImpl> impls = availableScanners();
+    if (name == "auto") { activeScanner() = impls.front(); return true; }
+    for (const ScannerImpl& impl : impls) {
+        if (name == impl.name) { activeScanner() = impl; return true; }
+    }
+    return false;
+}
+
+// 生成一行内所有方括号的位置，转义括号带 STRUCTURAL_ESCAPED 标记
+void indexStructurals(std::string_view line, std::vector<uint32_t>& out) {
+    out.clear();
+    const ClassifyBlockFn classify = activeScanner().classify;
+    uint64_t carryAmp = 0; // 上一块最后一个字节是否为 '&'
+    char tail[64];
+    for (size_t base = 0; base < line.size(); base += 64) {
+        const char* block = line.data() + base;
+        if (line.size() - base < 64) {
+            std::memset(tail, 0, sizeof(tail));
+            std::memcpy(tail, block, line.size() - base);
+            block = tail;
+        }
+        const BlockMasks m = classify(block);
+        uint64_t brackets = m.open | m.close;
+        const uint64_t escaped = brackets & ((m.amp << 1) | carryAmp);
+        carryAmp = m.amp >> 63;
+        while (brackets != 0) {
+            const unsigned bit = countTrailingZeros(brackets);
+            brackets &= brackets - 1;
+            out.push_back(static_cast<uint32_t>(base + bit) | (((escaped >> bit) & 1) ? STRUCTURAL_ESCAPED : 0));
+        }
+    }
+}
+
+// 行内记号: 文本片段、[指令]，或缺少 ']' 的未闭合指令
+struct Token {
+    enum class Kind { TEXT, COMMAND, UNTERMINATED };
+    Kind kind;
+    std::string_view raw;   // 原始字节，转义尚未还原; 指令不含两侧方括号
+    bool hasEscapes;        // raw 中是否出现 &[ 或 &]
+};
+
+// 分词器: 先用 indexStructurals() 批量找出方括号，再只在这些位置上推进，普通字节不再逐个检查。
+// 文本片段在下一个未转义的 '[' 处结束，指令在下一个未转义的 ']' 处结束。
+class LineTokenizer {
+public:
+    LineTokenizer(std::string_view line, std::vector<uint32_t>& structurals) : line_(line), structurals_(structurals) {
+        indexStructurals(line_, structurals_);
+    }
+
+    bool next(Token& token) {
+        if (pos_ >= line_.size()) return false;
+        const size_t start = pos_;
+        const bool command = line_[start] == '[';
+        if (command) ++index_; // 跳过起始的 '['
+        const char terminator = command ? ']' : '[';
+        bool escaped = false;
+        for (; index_ < structurals_.size(); ++index_) {
+            const uint32_t entry = structurals_[index_];
+            if (entry & STRUCTURAL_ESCAPED) { escaped = true; continue; }
+            if (line_[entry] != terminator) continue;
+            if (command) {
+                token = {Token::Kind::COMMAND, line_.substr(start + 1, entry - start - 1), escaped};
+                pos_ = entry + 1;
+                ++index_;
+            } else {
+                token = {Token::Kind::TEXT, line_.substr(start, entry - start), escaped};
+                pos_ = entry;
+            }
+            return true;
+        }
+        token = {command ? Token::Kind::UNTERMINATED : Token::Kind::TEXT, line_.substr(command ? start + 1 : start), escaped};
+        pos_ = line_.size();
+        return true;
+    }
+
+private:
+    std::string_view line_;
+    std::vector<uint32_t>& structurals_;
+    size_t index_ = 0;
+    size_t pos_ = 0;
+};
+
+// --- 定长字段的快速解析 ---
+// 以下函数不分配内存、不依赖 locale，语义与原先的 istream 提取保持一致: 数值前允许空白和正负号。
+
+bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f'; }
+
+void skipBlanks(std::string_view& str) {
+    size_t n = 0;
+    while (n < str.size() && isBlank(str[n])) ++n;
+    str.remove_prefix(n);
+}
+
+// 读取一个十进制整数并从 str 中移除
+bool readInt(std::string_view& str, int& value) {
+    skipBlanks(str);
+    if (!str.empty() && str[0] == '+') {
+        if (str.size() < 2 || str[1] < '0' || str[1] > '9') return false;
+        str.remove_prefix(1);
+    }
+    auto result = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (result.ec != std::errc()) return false;
+    str.remove_prefix(static_cast<size_t>(result.ptr - str.data()));
+    return true;
+}
+
+// 读取一个非空白字符并从 str 中移除
+bool readChar(std::string_view& str, char& c) {
+    skipBlanks(str);
+    if (str.empty()) return false;
+    c = str[0];
+    str.remove_prefix(1);
+    return true;
+}
+
+// 跳过一个以空白分隔的单词 (指令名)
+void skipWord(std::string_view& str) {
+    skipBlanks(str);
+    size_t n = 0;
+    while (n < str.size() && !isBlank(str[n])) ++n;
+    str.remove_prefix(n);
+}
+
+// 解析 mm.ss.zzz 时间戳
+bool parseTimestamp(std::string_view str, std::chrono::milliseconds& timestamp) {
+    int minutes = 0, seconds = 0, milliseconds = 0;
+    char dot1 = 0, dot2 = 0;
+    if (!readInt(str, minutes) || !readChar(str, dot1) || !readInt(str, seconds) || !readChar(str, dot2) || !readInt(str, milliseconds)) return false;
+    if (dot1 != '.' || dot2 != '.') return false;
+    timestamp = std::chrono::minutes(minutes) + std::chrono::seconds(seconds) + std::chrono::milliseconds(milliseconds);
+    return true;
+}
+
+// 解析两位十六进制数
+bool parseHexByte(std::string_view str, int& value) {
+    auto result = std::from_chars(str.data(), str.data() + 2, value, 16);
+    return result.ec == std::errc() && result.ptr == str.data() + 2;
+}
+
+// 单遍还原 &[ / &]
+void unescapeInto(std::string& out, std::string_view raw) {
+    out.clear();
+    out.reserve(raw.size());
+    for (size_t i = 0; i < raw.size(); ++i) {
+        if (raw[i] == '&' && i + 1 < raw.size() && (raw[i + 1] == '[' || raw[i + 1] == ']')) ++i;
+        out.push_back(raw[i]);
+    }
+}
+
+// 文本片段: 不含转义时直接使用映射区视图，否则还原后驻留 (相同内容只复制一次)
+std::string_view textPayload(const Token& token, TextArena& texts, std::string& scratch) {
+    if (!token.hasEscapes) return token.raw;
+    unescapeInto(scratch, token.raw);
+    return texts.get(texts.internCopy(scratch));
+}
+
+// 解析诊断。行号为所在分块内的相对行号，输出前由 mergeChunks() 换算成文件行号; 0 表示不带行号。
+struct Diagnostic {
+    bool warning;
+    int line;
+    std::string detail;
+};
+
+void printDiagnostic(const Diagnostic& diagnostic) {
+    std::cerr << (diagnostic.warning ? "警告: " : "错误: ");
+    if (diagnostic.line > 0) std::cerr << "第 " << diagnostic.line << " 行";
+    std::cerr << diagnostic.detail << std::endl;
+}
+
+// 一个分块 (若干完整的行) 的解析结果
+struct ParsedChunk {
+    ActionTable actions;
+    std::vector<Diagnostic> diagnostics;
+    std::string scratch; // 转义还原的临时缓冲区
+    bool fatal = false;
+    int lineCount = 0;
+    bool hasTimestamp = false;
+    std::chrono::milliseconds firstTimestamp{0}, lastTimestamp{0};
+    size_t diagnosticsBeforeFirstTimestamp = 0; // 第一个有效时间戳之前产生的诊断数量
+};
+
+// [space N]: 较短的空格串直接引用静态缓冲区
+std::string_view spaceRun(int count, TextArena& texts) {
+    static const std::string SPACES(256, ' ');
+    if (static_cast<size_t>(count) <= SPACES.size()) return std::string_view(SPACES).substr(0, static_cast<size_t>(count));
+    return texts.get(texts.internCopy(std::string(static_cast<size_t>(count), ' ')));
+}
+
+// 解析一行时间轴。lastTimestamp 为防乱轴检查的下限，解析成功后更新为本行时间戳。遇到致命错误时返回 false。
+bool parseTimelineLine(std::string_view line, int lineNumber, std::chrono::milliseconds& lastTimestamp, std::vector<uint32_t>& structurals, ParsedChunk& chunk) {
+    static const std::string_view WHITESPACE = " \t\n\r\v\f";
+    auto fail = [&](int line, std::string detail) {
+        chunk.diagnostics.push_back({false, line, std::move(detail)});
+        chunk.fatal = true;
+        return false;
+    };
+
+    LineTokenizer tokens(line, structurals);
+    Token token;
+    if (!tokens.next(token) || token.kind != Token::Kind::COMMAND) {
+        chunk.diagnostics.push_back({false, lineNumber, "时间戳格式错误。"});
+        return true;
+    }
+
+    std::string_view timestamp_str = token.raw;
+    std::chrono::milliseconds currentTimestamp;
+    if (!parseTimestamp(timestamp_str, currentTimestamp)) {
+        chunk.diagnostics.push_back({false, lineNumber, "时间戳解析失败。应为 [mm.ss.zzz] 格式，实际为 '[" + std::string(timestamp_str) + "]'。"});
+        return true;
+    }
+
+    if (!chunk.hasTimestamp) {
+        chunk.hasTimestamp = true;
+        chunk.firstTimestamp = currentTimestamp;
+        chunk.diagnosticsBeforeFirstTimestamp = chunk.diagnostics.size();
+    }
+    if (currentTimestamp < lastTimestamp) return fail(0, "【防乱轴】...");
+    lastTimestamp = currentTimestamp;
+    chunk.lastTimestamp = currentTimestamp;
+
+    while (tokens.next(token)) {
+        if (token.kind == Token::Kind::TEXT) {
+            if (token.raw.find_first_not_of(WHITESPACE) != std::string_view::npos) {
+                chunk.actions.append({lineNumber, currentTimestamp, CommandType::PRINT_TEXT, textPayload(token, chunk.actions.texts(), chunk.scratch)});
+            }
+            continue;
+        }
+        if (token.kind == Token::Kind::UNTERMINATED) return fail(lineNumber, "指令格式错误...");
+        std::string_view command = token.raw;
+        
+        if (command == "newline") chunk.actions.append({lineNumber, currentTimestamp, CommandType::NEWLINE});
+        else if (command == "newlinenp") chunk.actions.append({lineNumber, currentTimestamp, CommandType::NEWLINE_NO_PROMPT});
+        else if (command == "clear") chunk.actions.append({lineNumber, currentTimestamp, CommandType::CLEAR_SCREEN});
+        else if (startsWith(command, "space")) {
+            std::string_view args = command;
+            int count = 1;
+
+            skipWord(args);
+            if (!readInt(args, count)) {
+                count = 1;
+            }
+            if(count <1)count =1;
+            chunk.actions.append({lineNumber,currentTimestamp,CommandType::PRINT_TEXT, spaceRun(count, chunk.actions.texts())});
+        }
+        else if (startsWith(command, "mv ")) {
+            std::string_view args = command; int r, c;
+            skipWord(args);
+            if (readInt(args, r) && readInt(args, c)) chunk.actions.append({lineNumber, currentTimestamp, CommandType::MOVE_CURSOR, {}, r, c});
+            else chunk.diagnostics.push_back({true, lineNumber, ": [mv] 指令参数格式错误，将被忽略。"});
+        }
+        else if (command == "bold") chunk.actions.append({lineNumber, currentTimestamp, CommandType::STYLE_BOLD});
+        else if (command == "italic") chunk.actions.append({lineNumber, currentTimestamp, CommandType::STYLE_ITALIC});
+        else if (command == "underline") chunk.actions.append({lineNumber, currentTimestamp, CommandType::STYLE_UNDERLINE});
+        else if (command == "strikethrough") chunk.actions.append({lineNumber, currentTimestamp, CommandType::STYLE_STRIKETHROUGH});
+        else if (startsWith(command, "color ")) {
+             std::string_view payload = command.substr(6);
+             if (payload == "default") chunk.actions.append({lineNumber, currentTimestamp, CommandType::STYLE_RESET});
+             else {
+                 if (payload.length() != 6 || payload.find_first_not_of("0123456789abcdefABCDEF") != std::string_view::npos) return fail(lineNumber, "颜色代码 '" + std::string(payload) + "' 格式错误...");
+                 int r, g, b;
+                 if (parseHexByte(payload.substr(0, 2), r) && parseHexByte(payload.substr(2, 2), g) && parseHexByte(payload.substr(4, 2), b)) chunk.actions.append({lineNumber, currentTimestamp, CommandType::COLOR_RGB, {}, 0, 0, r, g, b});
+                 else return fail(lineNumber, "颜色代码 '" + std::string(payload) + "' 转换失败。");
+             }
+        } else if (startsWith(command, "background ")){
+            std::string_view payload = command.substr(11);
+            if(payload.length() != 8 || payload.find_first_not_of("0123456789abcdefABCDEF") != std::string_view::npos) {
+                return fail(lineNumber, "背景颜色代码 '" + std::string(payload) + "' 格式错误。应为8位十六进制 rrggbbaa。");
+            }
+            int r, g, b, a;
+            if (parseHexByte(payload.substr(0,2), r) && parseHexByte(payload.substr(2,2), g) && parseHexByte(payload.substr(4,2), b) && parseHexByte(payload.substr(6,2), a)) {
+                chunk.actions.append({lineNumber, currentTimestamp, CommandType::BACKGROUND_RGB, {}, 0,0,r,g,b,a});
+            } else {
+                return fail(lineNumber, "背景颜色代码 '" + std::string(payload) + "' 转换失败。");
+            }
+        }
+        else if (startsWith(command, "size ")) chunk.diagnostics.push_back({true, lineNumber, "：[size] 指令不被支持，将被忽略。"});
+    }
+    return true;
+}
+
+// 解析一段以整行为边界的时间轴文本。块内只能检查相对顺序，跨块的防乱轴检查由 mergeChunks() 完成。
+void parseChunk(std::string_view data, std::chrono::milliseconds lastTimestamp, ParsedChunk& chunk) {
+    std::vector<uint32_t> structurals; // 各行复用，避免反复分配
+    size_t cursor = 0;
+    while (cursor < data.size()) {
+        size_t end = data.find('\n', cursor);
+        if (end == std::string_view::npos) end = data.size();
+        std::string_view line = data.substr(cursor, end - cursor);
+        cursor = end + 1;
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        const int lineNumber = ++chunk.lineCount;
+
+        if (line.empty() || startsWith(line, "//")) continue;
+        if (!parseTimelineLine(line, lineNumber, lastTimestamp, structurals, chunk)) return;
+    }
+}
+
+// 按顺序合并各分块: 输出诊断、检查分块交界处的时间戳顺序，并把相对行号换算成文件行号
+bool mergeChunks(std::vector<ParsedChunk>& chunks, int lineBase, Script& script) {
+    size_t total = script.actions.size();
+    for (const ParsedChunk& chunk : chunks) total += chunk.actions.size();
+    script.actions.reserve(total);
+
+    std::chrono::milliseconds lastTimestamp(0);
+    for (ParsedChunk& chunk : chunks) {
+        for (Diagnostic& diagnostic : chunk.diagnostics) {
+            if (diagnostic.line > 0) diagnostic.line += lineBase;
+        }
+        if (chunk.hasTimestamp && chunk.firstTimestamp < lastTimestamp) {
+            for (size_t i = 0; i < chunk.diagnosticsBeforeFirstTimestamp; ++i) printDiagnostic(chunk.diagnostics[i]);
+            printDiagnostic({false, 0, "【防乱轴】..."});
+            return false;
+        }
+        for (const Diagnostic& diagnostic : chunk.diagnostics) printDiagnostic(diagnostic);
+        if (chunk.fatal) return false;
+
+        script.actions.append(chunk.actions, lineBase);
+        if (chunk.hasTimestamp) lastTimestamp = chunk.lastTimestamp;
+        lineBase += chunk.lineCount;
+    }
+    return true;
+}
+
+// 在行边界处把文本切成至多 parts 块，过小的输入不再切分
+std::vector<std::string_view> splitAtLines(std::string_view data, unsigned parts) {
+    constexpr size_t MIN_CHUNK = 64 * 1024;
+    parts = static_cast<unsigned>(std::clamp<size_t>(data.size() / MIN_CHUNK, 1, std::max(1u, parts)));
+    std::vector<std::string_view> chunks;
+    size_t begin = 0;
+    for (unsigned i = 1; i <= parts && begin < data.size(); ++i) {
+        size_t end = data.size();
+        if (i < parts) {
+            size_t newline = data.find('\n', std::max(begin, data.size() / parts * i));
+            if (newline != std::string_view::npos) end = newline + 1;
+        }
+        chunks.push_back(data.substr(begin, end - begin));
+        begin = end;
+    }
+    return chunks;
+}
+
+// 解析第一行的 [username]，返回时间轴正文的起始偏移和正文之前的行数
+bool parseUsernameLine(std::string_view data, Script& script, size_t& bodyStart, int& lineBase) {
+    bodyStart = 0;
+    lineBase = 0;
+    if (data.empty()) return true;
+    size_t end = data.find('\n');
+    std::string_view line = data.substr(0, end);
+    bodyStart = end == std::string_view::npos ? data.size() : end + 1;
+    lineBase = 1;
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (startsWith(line, "[username]")) script.username = std::string(line.substr(10));
+    else { std::cerr << "错误: 文件第一行必须以 '[username]' 开头。" << std::endl; return false; }
+    return true;
+}
+
+// 解析内存中的脚本文本。文本载荷直接引用 data，调用方需保证 data 的生命周期不短于 script。
+// jobs > 1 时按行边界切块并行解析，结果与顺序解析完全一致。
+bool parseSource(std::string_view data, Script& script, unsigned jobs = 1) {
+    size_t bodyStart = 0;
+    int lineBase = 0;
+    if (!parseUsernameLine(data, script, bodyStart, lineBase)) return false;
+
+    std::vector<std::string_view> parts = splitAtLines(data.substr(bodyStart), jobs);
+    std::vector<ParsedChunk> chunks(parts.size());
+    if (parts.size() == 1) {
+        parseChunk(parts[0], std::chrono::milliseconds(0), chunks[0]);
+    } else {
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < parts.size(); ++i) {
+            // 只有第一块从 0 开始检查; 其余分块的起点由合并时与前一块比较
+            auto lowerBound = i == 0 ? std::chrono::milliseconds(0) : std::chrono::milliseconds::min();
+            workers.emplace_back(parseChunk, parts[i], lowerBound, std::ref(chunks[i]));
+        }
+        for (std::thread& worker : workers) worker.join();
+    }
+    return mergeChunks(chunks, lineBase, script);
+}
 
-#define MA_ENABLE_MP3
-#define MINIAUDIO_IMPLEMENTATION
-#include "miniaudio.h"
+// --- 流式解析 (边解析边播放) ---
 
-// 指令类型枚举
-enum class CommandType {
-    PRINT_TEXT, NEWLINE, NEWLINE_NO_PROMPT, CLEAR_SCREEN, MOVE_CURSOR, 
-    STYLE_BOLD, STYLE_ITALIC, STYLE_UNDERLINE, STYLE_STRIKETHROUGH, STYLE_RESET, COLOR_RGB, BACKGROUND_RGB
+// 有界的无锁单生产者/单消费者环形队列。槽位原地读写: 生产者填好 writeSlot() 后 commitWrite()，
+// 消费者用完 readSlot() 后 commitRead()，槽位内的缓冲区因此可以在两端之间反复复用。
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    T* writeSlot() {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head - cachedTail_ == slots_.size()) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head - cachedTail_ == slots_.size()) return nullptr;
+        }
+        return &slots_[head & mask_];
+    }
+    void commitWrite() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    T* readSlot() {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == cachedHead_) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail == cachedHead_) return nullptr;
+        }
+        return &slots_[tail & mask_];
+    }
+    void commitRead() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+    std::vector<T> slots_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) size_t cachedTail_ = 0;        // 仅生产者使用
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) size_t cachedHead_ = 0;        // 仅消费者使用
 };
 
-// 播放指令的数据结构
-struct PlaybackAction {
-    int sourceLineNumber; std::chrono::milliseconds timestamp; CommandType type;
-    std::string text_payload; int cursor_row; int cursor_col; int r = 0, g = 0, b = 0, a = 0;
+// 队列中的一行: 该行的全部动作及其预渲染出的 tick，经转义改写的文本保存在动作表自己的文本池中。两者的容量在各行之间复用。
+struct StreamSlot {
+    ActionTable actions;
+    RenderedTicks rendered;
+};
+
+// 解析线程与播放线程共享的状态。队列容量固定，因此内存占用与脚本长度无关。
+class ActionStream {
+public:
+    enum class State { RUNNING, FINISHED, FAILED, CANCELLED };
+    static constexpr size_t CAPACITY = 1024; // 行数
+
+    ActionStream() : ring_(CAPACITY) {}
+    ~ActionStream() { stop(); }
+
+    // 在后台线程中解析 body (第 lineBase + 1 行起的时间轴正文)，并用 renderer 预渲染; renderer 此后只由解析线程使用
+    void start(std::string_view body, int lineBase, Renderer& renderer) {
+        renderer_ = &renderer;
+        worker_ = std::thread([this, body, lineBase] { produce(body, lineBase); });
+    }
+
+    // 取消解析并等待线程退出，例如播放因防超时提前结束时
+    void stop() {
+        State expected = State::RUNNING;
+        state_.compare_exchange_strong(expected, State::CANCELLED);
+        if (worker_.joinable()) worker_.join();
+    }
+
+    // 取下一个 tick; 读完一行后该行的槽位在此时归还给队列。队列为空时等待解析线程。
+    // 一行内的动作时间戳相同，因此通常一行就是一个 tick。
+    bool next(TickRef& tick) {
+        if (holding_ && holdIndex_ < holding_->rendered.size()) {
+            tick = holding_->rendered.tick(holdIndex_++);
+            return true;
+        }
+        if (holding_) {
+            ring_.commitRead();
+            holding_ = nullptr;
+        }
+        for (unsigned spins = 0;; ++spins) {
+            if ((holding_ = ring_.readSlot()) != nullptr) break;
+            if (state_.load(std::memory_order_acquire) != State::RUNNING) {
+                // 生产者先入队再修改状态，因此这里再检查一次即可取到最后的动作
+                if ((holding_ = ring_.readSlot()) == nullptr) return false;
+                break;
+            }
+            backoff(spins);
+        }
+        tick = holding_->rendered.tick(0);
+        holdIndex_ = 1;
+        return true;
+    }
+
+    // 等到第一个动作可用 (或解析结束)，用于确定开始播放的时刻
+    void waitUntilReady() {
+        for (unsigned spins = 0; ring_.readSlot() == nullptr && state_.load(std::memory_order_acquire) == State::RUNNING; ++spins) backoff(spins);
+    }
+
+    bool failed() const { return state_.load(std::memory_order_acquire) == State::FAILED; }
+    const std::vector<Diagnostic>& diagnostics() const { return diagnostics_; } // 仅在 stop() 之后读取
+    size_t actionCount() const { return actionCount_; }                          // 同上
+    const TextArena::Stats& textStats() const { return textStats_; }             // 同上
+    uint64_t renderedBytes() const { return renderedBytes_; }                     // 同上
+    uint64_t tickCount() const { return tickCount_; }                             // 同上
+
+private:
+    static void backoff(unsigned spins) {
+        if (spins < 64) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(spins < 1024 ? 50 : 1000));
+    }
+
+    void produce(std::string_view body, int lineBase) {
+        ParsedChunk line; // 逐行复用
+        RenderedTicks rendered;
+        std::vector<uint32_t> structurals;
+        std::chrono::milliseconds lastTimestamp(0);
+        int lineNumber = lineBase;
+        size_t cursor = 0;
+        bool ok = true;
+        while (ok && cursor < body.size()) {
+            size_t end = body.find('\n', cursor);
+            if (end == std::string_view::npos) end = body.size();
+            std::string_view text = body.substr(cursor, end - cursor);
+            cursor = end + 1;
+            if (!text.empty() && text.back() == '\r') text.remove_suffix(1);
+            ++lineNumber;
+            if (text.empty() || startsWith(text, "//")) continue;
+
+            line.actions.clear();
+            line.diagnostics.clear();
+            ok = parseTimelineLine(text, lineNumber, lastTimestamp, structurals, line);
+            diagnostics_.insert(diagnostics_.end(), line.diagnostics.begin(), line.diagnostics.end());
+            if (!ok) break;
+            if (line.actions.empty()) continue;
+            actionCount_ += line.actions.size();
+            renderTicks(line.actions, *renderer_, rendered);
+            const TextArena::Stats& lineStats = line.actions.texts().stats();
+            textStats_.references += lineStats.references;
+            textStats_.referencedBytes += lineStats.referencedBytes;
+            textStats_.ownedBytes += lineStats.ownedBytes;
+            renderedBytes_ += rendered.byteCount();
+            tickCount_ += rendered.size();
+            StreamSlot* slot;
+            for (unsigned spins = 0; (slot = ring_.writeSlot()) == nullptr; ++spins) {
+                if (state_.load(std::memory_order_acquire) == State::CANCELLED) return;
+                backoff(spins);
+            }
+            // 交换而非复制: 槽位拿走本行的动作表，本行换回槽位上一轮用过的表继续复用其容量
+            std::swap(slot->actions, line.actions);
+            std::swap(slot->rendered, rendered);
+            ring_.commitWrite();
+        }
+        State expected = State::RUNNING;
+        state_.compare_exchange_strong(expected, ok ? State::FINISHED : State::FAILED, std::memory_order_release);
+    }
+
+    SpscRing<StreamSlot> ring_;
+    std::atomic<State> state_{State::RUNNING};
+    std::thread worker_;
+    StreamSlot* holding_ = nullptr;
+    size_t holdIndex_ = 0;
+    Renderer* renderer_ = nullptr;
+    std::vector<Diagnostic> diagnostics_;
+    size_t actionCount_ = 0; // 以下统计均由解析线程写入
+    TextArena::Stats textStats_;
+    uint64_t renderedBytes_ = 0;
+    uint64_t tickCount_ = 0;
+};
+
+// --- 编译格式 (.clipb) ---
+// 布局: ClipbHeader | ClipbAction[actionCount] | 字符串池 (去重后的文本载荷与用户名)。
+// 所有整数按本机字节序写入，由 endianTag 校验; 加载时文本载荷直接指向映射区，无需任何解析。
+constexpr char CLIPB_MAGIC[8] = {'C', 'L', 'I', 'P', 'B', '\0', '\r', '\n'};
+constexpr uint32_t CLIPB_VERSION = 1;
+constexpr uint32_t CLIPB_ENDIAN_TAG = 0x01020304u;
+
+struct ClipbHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    uint64_t actionCount;
+    uint64_t blobSize;
+    uint32_t usernameOffset, usernameLength;   // 位于字符串池中
+    uint32_t sourcePathOffset, sourcePathLength;
+    uint64_t sourceSize;                       // 编译时源脚本的大小与修改时间，用于识别过期文件
+    int64_t sourceMtime;
+    uint64_t contentHash;                      // 动作表与字符串池的校验和
+};
+
+struct ClipbAction {
+    int64_t timestampMs;
+    uint32_t sourceLine;
+    uint8_t type;
+    uint8_t r, g, b;
+    uint32_t arg0;   // PRINT_TEXT: 文本偏移; MOVE_CURSOR: 行; BACKGROUND_RGB: 透明度
+    uint32_t arg1;   // PRINT_TEXT: 文本长度; MOVE_CURSOR: 列
 };
 
-// 字符串替换辅助函数
-void replaceAll(std::string& str, const std::string& from, const std::string& to) {
-    if (from.empty()) return;
-    size_t start_pos = 0;
-    while ((start_pos = str.find(from, start_pos)) != std::string::npos) {
-        str.replace(start_pos, from.length(), to);
-        start_pos += to.length();
+static_assert(sizeof(ClipbHeader) % 8 == 0 && sizeof(ClipbAction) % 8 == 0, "clipb 记录需按 8 字节对齐");
+
+// 按 8 字节分组的 FNV-1a 变体，足够快以便每次加载都能完整校验
+class ContentHasher {
+public:
+    void update(const char* data, size_t size) {
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            hash_ = (hash_ ^ word) * 0x100000001b3ull;
+        }
+        for (; i < size; ++i) hash_ = (hash_ ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ull;
     }
+    uint64_t value() const { return hash_; }
+
+private:
+    uint64_t hash_ = 0xcbf29ce484222325ull;
+};
+
+// 源脚本的大小与修改时间
+bool sourceStamp(const std::string& path, uint64_t& size, int64_t& mtime) {
+    std::error_code ec;
+    size = static_cast<uint64_t>(std::filesystem::file_size(path, ec));
+    if (ec) return false;
+    auto time = std::filesystem::last_write_time(path, ec);
+    if (ec) return false;
+    mtime = static_cast<int64_t>(time.time_since_epoch().count());
+    return true;
 }
 
-// 终端控制函数
-void enableAnsiSupport() {
-#ifdef _WIN32
-    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE); if (hOut == INVALID_HANDLE_VALUE) return;
-    DWORD dwMode = 0; if (!GetConsoleMode(hOut, &dwMode)) return;
-    dwMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING; SetConsoleMode(hOut, dwMode);
-#endif
+bool isCompiledScript(std::string_view data) {
+    return data.size() >= sizeof(CLIPB_MAGIC) && std::memcmp(data.data(), CLIPB_MAGIC, sizeof(CLIPB_MAGIC)) == 0;
 }
 
-struct AudioPlayer {
-    ma_engine engine;
-    bool initialized = false;
+// 将已校验的动作序列写成 .clipb
+bool writeCompiledScript(const std::string& outPath, const Script& script, const std::string& sourcePath) {
+    std::string blob;
+    std::unordered_map<std::string_view, uint32_t> interned; // 键引用 script 与 absoluteSource，二者在本函数内都有效
+    auto intern = [&](std::string_view text, uint32_t& offset, uint32_t& length) {
+        if (blob.size() + text.size() > UINT32_MAX) return false;
+        auto found = interned.find(text);
+        if (found == interned.end()) {
+            found = interned.emplace(text, static_cast<uint32_t>(blob.size())).first;
+            blob.append(text);
+        }
+        offset = found->second;
+        length = static_cast<uint32_t>(text.size());
+        return true;
+    };
 
-    AudioPlayer(const std::string& music_path) {
-        ma_result result = ma_engine_init(NULL, &engine);
-        if(result != MA_SUCCESS) {
-            std::cerr << "警告: 初始化音频引擎失败, code: " << result << std::endl;
-            return;
+    ClipbHeader header{};
+    std::memcpy(header.magic, CLIPB_MAGIC, sizeof(CLIPB_MAGIC));
+    header.version = CLIPB_VERSION;
+    header.endianTag = CLIPB_ENDIAN_TAG;
+    header.actionCount = script.actions.size();
+    std::error_code ec;
+    std::string absoluteSource = std::filesystem::absolute(sourcePath, ec).string();
+    if (ec) absoluteSource = sourcePath;
+    sourceStamp(sourcePath, header.sourceSize, header.sourceMtime);
+
+    std::vector<ClipbAction> table;
+    table.reserve(script.actions.size());
+    bool fits = intern(script.username, header.usernameOffset, header.usernameLength)
+             && intern(absoluteSource, header.sourcePathOffset, header.sourcePathLength);
+    for (size_t i = 0; i < script.actions.size() && fits; ++i) {
+        const ActionRef action{&script.actions, i};
+        ClipbAction record{};
+        record.timestampMs = action.timestamp().count();
+        record.sourceLine = static_cast<uint32_t>(action.sourceLine());
+        record.type = static_cast<uint8_t>(action.type());
+        switch (action.type()) {
+            case CommandType::PRINT_TEXT: fits = intern(action.text(), record.arg0, record.arg1); break;
+            case CommandType::MOVE_CURSOR: record.arg0 = static_cast<uint32_t>(action.cursorRow()); record.arg1 = static_cast<uint32_t>(action.cursorCol()); break;
+            case CommandType::COLOR_RGB:
+            case CommandType::BACKGROUND_RGB:
+                record.r = static_cast<uint8_t>(action.r());
+                record.g = static_cast<uint8_t>(action.g());
+                record.b = static_cast<uint8_t>(action.b());
+                record.arg0 = static_cast<uint32_t>(action.a());
+                break;
+            default: break;
         }
+        table.push_back(record);
+    }
+    if (!fits) { std::cerr << "错误: 文本载荷总量超过 4 GiB，无法编译。" << std::endl; return false; }
 
-        result = ma_engine_play_sound(&engine, music_path.c_str(), NULL);
-        if(result != MA_SUCCESS) {
-            std::cerr << "警告: 播放音频文件 '" << music_path << "' 失败, code: " << result << std::endl;
-            ma_engine_uninit(&engine); // 初始化成功但播放失败，需要清理
+    header.blobSize = blob.size();
+    ContentHasher hasher;
+    hasher.update(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(ClipbAction));
+    hasher.update(blob.data(), blob.size());
+    header.contentHash = hasher.value();
+
+    std::ofstream out(outPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) { std::cerr << "错误: 无法写入文件 '" << outPath << "'" << std::endl; return false; }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(ClipbAction)));
+    out.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+    if (!out) { std::cerr << "错误: 写入文件 '" << outPath << "' 失败。" << std::endl; return false; }
+    std::cout << "已编译 " << table.size() << " 个动作到 '" << outPath << "' (字符串池 " << blob.size() << " 字节)。" << std::endl;
+    return true;
+}
+
+// 从映射区加载 .clipb，文本载荷直接引用映射区
+bool loadCompiledScript(const std::string& filename, std::string_view data, Script& script) {
+    ClipbHeader header;
+    if (data.size() < sizeof(header)) { std::cerr << "错误: 编译文件 '" << filename << "' 已损坏 (文件头不完整)。" << std::endl; return false; }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (header.endianTag != CLIPB_ENDIAN_TAG) { std::cerr << "错误: 编译文件 '" << filename << "' 的字节序与本机不符，请重新编译。" << std::endl; return false; }
+    if (header.version != CLIPB_VERSION) {
+        std::cerr << "错误: 编译文件 '" << filename << "' 的格式版本为 " << header.version << "，当前播放器仅支持版本 " << CLIPB_VERSION << "，请重新编译。" << std::endl;
+        return false;
+    }
+    // 逐项与剩余字节比较而不做加法，避免构造的 actionCount / blobSize 在 uint64 上回绕后越过映射区
+    const uint64_t payloadBytes = data.size() - sizeof(header);
+    const uint64_t tableBytes = header.actionCount * sizeof(ClipbAction);
+    if (header.actionCount > payloadBytes / sizeof(ClipbAction) || header.blobSize != payloadBytes - tableBytes) {
+        std::cerr << "错误: 编译文件 '" << filename << "' 已损坏 (大小不符)。" << std::endl;
+        return false;
+    }
+    const char* tableData = data.data() + sizeof(header);
+    const std::string_view blob(tableData + tableBytes, header.blobSize);
+    ContentHasher hasher;
+    hasher.update(tableData, tableBytes);
+    hasher.update(blob.data(), blob.size());
+    if (hasher.value() != header.contentHash) { std::cerr << "错误: 编译文件 '" << filename << "' 已损坏 (校验和不符)。" << std::endl; return false; }
+
+    auto blobView = [&](uint32_t offset, uint32_t length, std::string_view& out) {
+        if (offset > blob.size() || length > blob.size() - offset) return false;
+        out = blob.substr(offset, length);
+        return true;
+    };
+    std::string_view username, sourcePath;
+    if (!blobView(header.usernameOffset, header.usernameLength, username) || !blobView(header.sourcePathOffset, header.sourcePathLength, sourcePath)) {
+        std::cerr << "错误: 编译文件 '" << filename << "' 已损坏 (字符串越界)。" << std::endl;
+        return false;
+    }
+
+    // 源脚本仍然存在且在编译后被修改过，则拒绝加载
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    if (sourceStamp(std::string(sourcePath), size, mtime) && (size != header.sourceSize || mtime != header.sourceMtime)) {
+        std::cerr << "错误: 编译文件 '" << filename << "' 已过期: 源脚本 '" << sourcePath << "' 在编译后被修改，请重新编译。" << std::endl;
+        return false;
+    }
+
+    script.username = std::string(username);
+    script.actions.clear();
+    script.actions.reserve(header.actionCount);
+    std::unordered_map<uint64_t, uint32_t> textIds; // 字符串池已去重，按 (偏移, 长度) 登记即可，无需再哈希文本内容
+    for (uint64_t i = 0; i < header.actionCount; ++i) {
+        ClipbAction record;
+        std::memcpy(&record, tableData + i * sizeof(ClipbAction), sizeof(record));
+        if (record.type > static_cast<uint8_t>(CommandType::BACKGROUND_RGB)) { std::cerr << "错误: 编译文件 '" << filename << "' 已损坏 (未知指令类型)。" << std::endl; return false; }
+        PlaybackAction action{static_cast<int>(record.sourceLine), std::chrono::milliseconds(record.timestampMs), static_cast<CommandType>(record.type), {}, 0, 0, record.r, record.g, record.b};
+        switch (action.type) {
+            case CommandType::PRINT_TEXT: {
+                if (!blobView(record.arg0, record.arg1, action.text_payload)) { std::cerr << "错误: 编译文件 '" << filename << "' 已损坏 (字符串越界)。" << std::endl; return false; }
+                auto found = textIds.emplace((uint64_t(record.arg0) << 32) | record.arg1, 0);
+                if (found.second) found.first->second = script.actions.texts().add(action.text_payload);
+                else script.actions.texts().countReference(action.text_payload.size());
+                script.actions.appendText(action.sourceLineNumber, action.timestamp, found.first->second);
+                continue;
+            }
+            case CommandType::MOVE_CURSOR: action.cursor_row = static_cast<int32_t>(record.arg0); action.cursor_col = static_cast<int32_t>(record.arg1); break;
+            case CommandType::BACKGROUND_RGB: action.a = static_cast<int>(record.arg0); break;
+            default: break;
+        }
+        script.actions.append(action);
+    }
+    return true;
+}
+
+// --stats: 文本驻留池的去重统计
+void printTextStats(const Script& script) {
+    const TextArena& texts = script.actions.texts();
+    const TextArena::Stats& stats = texts.stats();
+    const double saved = stats.referencedBytes == 0 ? 0.0 : 100.0 * (1.0 - static_cast<double>(texts.distinctBytes()) / static_cast<double>(stats.referencedBytes));
+    std::cout << "动作总数: " << script.actions.size() << "\n"
+              << "文本引用: " << stats.references << " 次, 共 " << stats.referencedBytes << " 字节\n"
+              << "不同文本: " << texts.distinct() << " 条, 共 " << texts.distinctBytes() << " 字节 (去重节省 " << saved << "%)\n"
+              << "复制进驻留池: " << stats.ownedBytes << " 字节 (其余文本直接引用映射区)" << std::endl;
+    if (script.rendered.size() != 0) std::cout << "预渲染输出: " << script.rendered.byteCount() << " 字节, " << script.rendered.size() << " 个 tick (每个 tick 一次写出)" << std::endl;
+}
+
+// --stream 的 --stats: 逐行解析时文本池只在行内去重，因此只给出引用与复制的总量
+void printStreamStats(const ActionStream& stream) {
+    const TextArena::Stats& stats = stream.textStats();
+    std::cout << "动作总数: " << stream.actionCount() << "\n"
+              << "文本引用: " << stats.references << " 次, 共 " << stats.referencedBytes << " 字节\n"
+              << "复制进驻留池: " << stats.ownedBytes << " 字节 (其余文本直接引用映射区)\n"
+              << "预渲染输出: " << stream.renderedBytes() << " 字节, " << stream.tickCount() << " 个 tick (每个 tick 一次写出)" << std::endl;
+}
+
+// 加载脚本: 根据文件头自动区分 .clip 文本与 .clipb 编译文件
+bool loadScript(const std::string& filename, Script& script, unsigned jobs = 1) {
+    if (!script.source.open(filename)) { std::cerr << "错误: 无法打开文件 '" << filename << "'" << std::endl; return false; }
+    const bool ok = isCompiledScript(script.source.view()) ? loadCompiledScript(filename, script.source.view(), script) : parseSource(script.source.view(), script, jobs);
+    script.actions.texts().freeze();
+    return ok;
+}
+
+// 分词器基准测试: 构造含大量转义括号的长行，验证耗时随转义数量线性增长
+int runTokenizerBenchmark() {
+    std::cout << "转义数量\t行字节数\t总耗时(us)\t每个转义(ns)" << std::endl;
+    for (size_t escapes = 1000; escapes <= 256000; escapes *= 2) {
+        std::string source = "[username]bench\n[00.00.000][bold]";
+        for (size_t i = 0; i < escapes / 2; ++i) source += "&[\xE2\x94\x80&]";
+        source += '\n';
+
+        const int rounds = 5;
+        auto best = std::chrono::steady_clock::duration::max();
+        for (int round = 0; round < rounds; ++round) {
+            Script script;
+            auto begin = std::chrono::steady_clock::now();
+            if (!parseSource(source, script)) return 1;
+            best = std::min(best, std::chrono::steady_clock::now() - begin);
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(best).count();
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(best).count();
+        std::cout << escapes << "\t" << source.size() << "\t" << us << "\t" << static_cast<double>(ns) / escapes << std::endl;
+    }
+
+    // 各扫描实现在以中文为主的脚本上的吞吐量
+    std::string source = "[username]bench\n";
+    for (int i = 0; i < 20000; ++i) {
+        source += "[00.00.000][mv 5 10][color 55aaff]";
+        for (int j = 0; j < 6; ++j) source += "这是一段用于测试结构字符扫描吞吐量的中文文本，";
+        source += "&[注释&][newline]\n";
+    }
+    std::cout << "\n扫描实现\t吞吐量(MB/s)" << std::endl;
+    const std::string previous = activeScanner().name;
+    for (const ScannerImpl& impl : availableScanners()) {
+        selectScanner(impl.name);
+        auto best = std::chrono::steady_clock::duration::max();
+        for (int round = 0; round < 5; ++round) {
+            Script script;
+            auto begin = std::chrono::steady_clock::now();
+            if (!parseSource(source, script)) return 1;
+            best = std::min(best, std::chrono::steady_clock::now() - begin);
+        }
+        double seconds = std::chrono::duration<double>(best).count();
+        std::cout << impl.name << "\t" << source.size() / seconds / 1e6 << std::endl;
+    }
+    selectScanner(previous);
+    return 0;
+}
+
+// --- 播放调度 ---
+// sleep: 只用 sleep_until，Linux 上通常会晚醒 50-1000 us。
+// hybrid: 先睡到截止时刻之前一小段余量，再用 pause 指令自旋到截止时刻; 余量在启动时按实测的唤醒延迟自动校准。
+// spin: 全程自旋，最精确但占满一个 CPU 核心。
+enum class SchedMode { SLEEP, HYBRID, SPIN };
+
+// 自旋等待时提示 CPU 降低功耗并让出流水线给同核的超线程
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+class Scheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Scheduler(SchedMode mode) : mode_(mode) {
+        if (mode_ == SchedMode::HYBRID) calibrate();
+    }
+
+    void waitUntil(Clock::time_point deadline) const {
+        if (mode_ == SchedMode::SLEEP) {
+            std::this_thread::sleep_until(deadline);
             return;
         }
+        if (mode_ == SchedMode::HYBRID && deadline - Clock::now() > margin_) sleepUntil(deadline - margin_);
+        while (Clock::now() < deadline) cpuRelax();
+    }
 
-        initialized = true;
+    SchedMode mode() const { return mode_; }
+    std::chrono::nanoseconds margin() const { return margin_; }
+
+private:
+    // 绝对时刻睡眠，不会因被信号打断重试而累积误差
+    static void sleepUntil(Clock::time_point deadline) {
+#if defined(__linux__)
+        // libstdc++ 与 libc++ 在 Linux 上的 steady_clock 均基于 CLOCK_MONOTONIC
+        const auto since = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        timespec target;
+        target.tv_sec = static_cast<time_t>(since / 1000000000);
+        target.tv_nsec = static_cast<long>(since % 1000000000);
+        while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, nullptr) == EINTR) {}
+#else
+        std::this_thread::sleep_until(deadline);
+#endif
     }
 
-    ~AudioPlayer() {
-        if (initialized) {
-            ma_engine_uninit(&engine);
-            std::cout << "音频引擎已关闭。" << std::endl;
+    // 多次短睡眠并记录实际晚醒的时间，取次大值再留出余地作为余量，避免偶发的长延迟把余量拉得过大
+    void calibrate() {
+        constexpr int SAMPLES = 16;
+        std::vector<Clock::duration> overshoots;
+        for (int i = 0; i < SAMPLES; ++i) {
+            const auto deadline = Clock::now() + std::chrono::microseconds(500);
+            sleepUntil(deadline);
+            overshoots.push_back(Clock::now() - deadline);
         }
+        std::sort(overshoots.begin(), overshoots.end());
+        const auto measured = std::chrono::duration_cast<std::chrono::nanoseconds>(overshoots[SAMPLES - 2]);
+        margin_ = std::clamp(measured + measured / 2 + std::chrono::microseconds(50), std::chrono::nanoseconds(std::chrono::microseconds(100)), std::chrono::nanoseconds(std::chrono::milliseconds(20)));
+    }
+
+    SchedMode mode_;
+    std::chrono::nanoseconds margin_{0};
+};
+
+// 按顺序遍历预渲染完的 tick
+class TickList {
+public:
+    explicit TickList(const RenderedTicks& rendered, size_t first = 0) : rendered_(rendered), index_(first) {}
+    bool next(TickRef& tick) {
+        if (index_ >= rendered_.size()) return false;
+        tick = rendered_.tick(index_++);
+        return true;
     }
+    void seek(size_t first) { index_ = first; }
+
+private:
+    const RenderedTicks& rendered_;
+    size_t index_;
 };
 
-void clearScreen() { std::cout << "\033[2J\033[H" << std::flush; }
-void moveCursor(int row, int col) { std::cout << "\033[" << row << ";" << col << "H" << std::flush; }
+// 播放时间轴: 把 tick 的时间戳换算为 steady_clock 上的截止时刻。
+// 默认以开始时刻为原点 (从中途开始时为开始时刻减去起点); 以音乐为主时钟时，原点由音乐位置反推，始终跟随实际听到的声音。
+// 倍速播放时，时间戳按倍速折算为实际时长。
+class Timeline {
+public:
+    using Clock = std::chrono::steady_clock;
 
-// 文件解析函数
-bool parseFile(const std::string& filename, std::vector<PlaybackAction>& actions, std::string& username) {
-    std::ifstream file(filename);
-    if (!file.is_open()) { std::cerr << "错误: 无法打开文件 '" << filename << "'" << std::endl; return false; }
+    explicit Timeline(const AudioPlayer* audio = nullptr, std::chrono::milliseconds startAt = std::chrono::milliseconds(0), double speed = 1.0)
+        : audio_(audio), startAt_(startAt), speed_(speed) {}
 
-    std::string line;
-    int lineNumber = 0;
-    std::chrono::milliseconds lastTimestamp(0);
+    void start() {
+        lastSample_ = Clock::now();
+        origin_ = lastSample_ - scaled(audio_ != nullptr ? audio_->position() : startAt_);
+    }
 
-    if (std::getline(file, line)) {
-        lineNumber++;
-        if (line.rfind("[username]", 0) == 0) username = line.substr(10);
-        else { std::cerr << "错误: 文件第一行必须以 '[username]' 开头。" << std::endl; return false; }
+    Clock::time_point deadline(std::chrono::milliseconds timestamp) {
+        if (audio_ != nullptr) follow();
+        return origin_ + scaled(timestamp);
     }
 
-    const std::string ESC_OPEN_BRACKET_PLACEHOLDER = "\x01\x01";
-    const std::string ESC_CLOSE_BRACKET_PLACEHOLDER = "\x02\x02";
-    const std::string WHITESPACE = " \t\n\r\v\f";
+    // 暂停、跳转或变速之后，从脚本时间 position 处以 speed 倍速重新起步 (音乐须已从同一位置重新开始)
+    void restart(std::chrono::milliseconds position, double speed) {
+        startAt_ = position;
+        speed_ = speed;
+        start();
+    }
 
-    while (std::getline(file, line)) {
-        lineNumber++;
+    // 此刻对应的脚本时间
+    std::chrono::milliseconds position() const {
+        const auto elapsed = std::chrono::duration<double, std::milli>(Clock::now() - origin_).count() * speed_;
+        return std::chrono::milliseconds(std::max<int64_t>(0, static_cast<int64_t>(elapsed)));
+    }
 
-        if(!line.empty() && line.back() =='\r') {
-            line.pop_back();
-        }
-        if (line.empty() || line.rfind("//", 0) == 0) continue;
-        
-        replaceAll(line, "&[", ESC_OPEN_BRACKET_PLACEHOLDER);
-        replaceAll(line, "&]", ESC_CLOSE_BRACKET_PLACEHOLDER);
+    double speed() const { return speed_; }
 
-        size_t first_bracket = line.find('[');
-        size_t first_closing_bracket = line.find(']');
-        if (first_bracket != 0 || first_closing_bracket == std::string::npos) {
-            std::cerr << "错误: 第 " << lineNumber << " 行时间戳格式错误。" << std::endl;
-            continue;
-        }
+    bool followsAudio() const { return audio_ != nullptr; }
 
-        std::string timestamp_str = line.substr(first_bracket + 1, first_closing_bracket - 1);
-        // int minutes, seconds, milliseconds;
-        // // [修正] 使用 sscanf 并匹配正确的 `.` 分隔符格式
-        // if (sscanf(timestamp_str.c_str(), "%d.%d.%d", &minutes, &seconds, &milliseconds) != 3) {
-        //     std::cerr << "错误: 第 " << lineNumber << " 行时间戳解析失败。应为 [mm.ss.zzz] 格式。" << std::endl;
-        std::istringstream ts_iss(timestamp_str);
-        int minutes = 0, seconds = 0, milliseconds = 0;
-        char dot1 = 0, dot2 = 0;
+private:
+    // 音乐位置的读数只会偏晚，反推出的原点只会偏后: 读到更早的原点立即采用，
+    // 更晚的原点只按时钟漂移可能的速度 (0.1%) 缓慢跟随; 相差过大说明设备卡顿过，直接重新对齐
+    void follow() {
+        constexpr auto RESYNC = std::chrono::milliseconds(100);
+        const auto now = Clock::now();
+        const auto candidate = now - scaled(audio_->position());
+        if (candidate < origin_ || candidate - origin_ > RESYNC) origin_ = candidate;
+        else origin_ += std::min<Clock::duration>(candidate - origin_, (now - lastSample_) / 1000);
+        lastSample_ = now;
+    }
 
-        ts_iss >> minutes >> dot1 >> seconds >> dot2 >> milliseconds;
-        if(ts_iss.fail() || dot1!='.' || dot2!='.'){
-            std::cerr << "错误: 第 " << lineNumber << " 行时间戳解析失败。应为 [mm.ss.zzz] 格式，实际为 '[" << timestamp_str << "]'。" << std::endl;
-            continue;
-        }
+    // 脚本时间换算为实际时长
+    Clock::duration scaled(std::chrono::nanoseconds scriptTime) const {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::nano>(static_cast<double>(scriptTime.count()) / speed_));
+    }
 
-        auto currentTimestamp = std::chrono::minutes(minutes) + std::chrono::seconds(seconds) + std::chrono::milliseconds(milliseconds);
-        if (currentTimestamp < lastTimestamp) { std::cerr << "错误: 【防乱轴】..." << std::endl; return false; }
-        lastTimestamp = currentTimestamp;
+    const AudioPlayer* audio_;
+    std::chrono::milliseconds startAt_;
+    double speed_;
+    Clock::time_point origin_;
+    Clock::time_point lastSample_;
+};
 
-        std::string remaining = line.substr(first_closing_bracket + 1);
-        
-        size_t textStart = 0;
-        while(textStart < remaining.length()) {
-            size_t commandStart = remaining.find('[', textStart);
-            if (commandStart == std::string::npos) {
-                std::string text = remaining.substr(textStart);
-                if (text.find_first_not_of(WHITESPACE) != std::string::npos) {
-                    replaceAll(text, ESC_OPEN_BRACKET_PLACEHOLDER, "[");
-                    replaceAll(text, ESC_CLOSE_BRACKET_PLACEHOLDER, "]");
-                    actions.push_back({lineNumber, currentTimestamp, CommandType::PRINT_TEXT, text});
-                }
-                break;
-            }
-            if (commandStart > textStart) {
-                std::string text = remaining.substr(textStart, commandStart - textStart);
-                if (text.find_first_not_of(WHITESPACE) != std::string::npos) {
-                    replaceAll(text, ESC_OPEN_BRACKET_PLACEHOLDER, "[");
-                    replaceAll(text, ESC_CLOSE_BRACKET_PLACEHOLDER, "]");
-                    actions.push_back({lineNumber, currentTimestamp, CommandType::PRINT_TEXT, text});
-                }
-            }
+// 以 speed 倍速从 startAt 开始播放音乐并给出时间轴。音乐没能开始输出，或指定了 --clock system 时，以系统时钟为准
+Timeline startMusic(AudioPlayer* player, bool followAudio, std::chrono::milliseconds startAt, double speed) {
+    if (player == nullptr || !player->initialized) return Timeline(nullptr, startAt, speed);
+    if (!player->start(startAt, speed)) {
+        std::cerr << "警告: 音频设备没有开始输出，改用系统时钟。" << std::endl;
+        return Timeline(nullptr, startAt, speed);
+    }
+    return Timeline(followAudio ? player : nullptr, startAt, speed);
+}
+
+// --- 交互控制 ---
+// 按键线程在原始模式下读取标准输入，把按键翻译为命令放入无锁队列; 播放循环只在等待的间隙取出命令处理，
+// 读键盘的系统调用不会出现在播放线程上，也就不会推迟动作。
+enum class Command : uint8_t { TOGGLE_PAUSE, SEEK_BACK, SEEK_FORWARD, SPEED_UP, SPEED_DOWN, QUIT };
+
+class KeyInput {
+public:
+    KeyInput() : queue_(16) {}
+    ~KeyInput() { stop(); }
+
+    // 标准输入不是终端或当前平台不支持时返回 false
+    bool start() {
+#ifdef _WIN32
+        return false;
+#else
+        if (!::isatty(STDIN_FILENO) || ::tcgetattr(STDIN_FILENO, &saved_) != 0) return false;
+        termios raw = saved_;
+        // 关闭行缓冲、回显与信号键 (Ctrl+C 作为退出命令处理，保证终端设置总能恢复); 输出处理 (OPOST) 保持不变
+        raw.c_lflag &= ~static_cast<tcflag_t>(ICANON | ECHO | ISIG);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        if (::tcsetattr(STDIN_FILENO, TCSANOW, &raw) != 0) return false;
+        active_ = true;
+        worker_ = std::thread([this] { run(); });
+        return true;
+#endif
+    }
+
+    void stop() {
+        if (!active_) return;
+        stopping_.store(true, std::memory_order_relaxed);
+        worker_.join();
+#ifndef _WIN32
+        ::tcsetattr(STDIN_FILENO, TCSANOW, &saved_);
+#endif
+        active_ = false;
+    }
+
+    bool poll(Command& command) {
+        Command* slot = queue_.readSlot();
+        if (slot == nullptr) return false;
+        command = *slot;
+        queue_.commitRead();
+        return true;
+    }
 
-            size_t commandEnd = remaining.find(']', commandStart);
-            if (commandEnd == std::string::npos) { std::cerr << "错误: 第 " << lineNumber << " 行指令格式错误..." << std::endl; return false; }
-            std::string command = remaining.substr(commandStart + 1, commandEnd - commandStart - 1);
-            
-            if (command == "newline") actions.push_back({lineNumber, currentTimestamp, CommandType::NEWLINE});
-            else if (command == "newlinenp") actions.push_back({lineNumber, currentTimestamp, CommandType::NEWLINE_NO_PROMPT});
-            else if (command == "clear") actions.push_back({lineNumber, currentTimestamp, CommandType::CLEAR_SCREEN});
-            else if (command.rfind("space", 0) == 0) {
-                std::istringstream cmd_iss(command);
-                std::string token;
-                int count = 1;
-
-                cmd_iss >> token;
-                if( !(cmd_iss >> count)) {
-                    count = 1;
+private:
+#ifndef _WIN32
+    // 每 100 ms 检查一次是否该退出; 标准输入可能与非阻塞输出共用同一个打开的终端，read 需要容忍 EAGAIN
+    void run() {
+        int escape = 0; // 0: 普通; 1: 读到 ESC; 2: 读到 ESC [
+        while (!stopping_.load(std::memory_order_relaxed)) {
+            pollfd fd{STDIN_FILENO, POLLIN, 0};
+            if (::poll(&fd, 1, 100) <= 0) continue;
+            char bytes[32];
+            const ssize_t count = ::read(STDIN_FILENO, bytes, sizeof(bytes));
+            if (count <= 0) {
+                if (count < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+                return;
+            }
+            for (ssize_t i = 0; i < count; ++i) {
+                const char c = bytes[i];
+                if (escape == 1) {
+                    escape = c == '[' ? 2 : 0;
+                    continue;
                 }
-                if(count <1)count =1;
-                actions.push_back({lineNumber,currentTimestamp,CommandType::PRINT_TEXT, std::string(count, ' ')});
-            }
-            else if (command.rfind("mv ", 0) == 0) {
-                std::string token; int r, c;
-                std::istringstream cmd_iss(command);
-                if (cmd_iss >> token >> r >> c) actions.push_back({lineNumber, currentTimestamp, CommandType::MOVE_CURSOR, "", r, c});
-                else std::cerr << "警告: 第 " << lineNumber << " 行: [mv] 指令参数格式错误，将被忽略。" << std::endl;
-            }
-            else if (command == "bold") actions.push_back({lineNumber, currentTimestamp, CommandType::STYLE_BOLD});
-            else if (command == "italic") actions.push_back({lineNumber, currentTimestamp, CommandType::STYLE_ITALIC});
-            else if (command == "underline") actions.push_back({lineNumber, currentTimestamp, CommandType::STYLE_UNDERLINE});
-            else if (command == "strikethrough") actions.push_back({lineNumber, currentTimestamp, CommandType::STYLE_STRIKETHROUGH});
-            else if (command.rfind("color ", 0) == 0) {
-                 std::string payload = command.substr(6);
-                 if (payload == "default") actions.push_back({lineNumber, currentTimestamp, CommandType::STYLE_RESET});
-                 else {
-                     if (payload.length() != 6 || payload.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) { std::cerr << "错误: 第 " << lineNumber << " 行颜色代码 '" << payload << "' 格式错误..." << std::endl; return false; }
-                     try { int r = std::stoi(payload.substr(0, 2), nullptr, 16); int g = std::stoi(payload.substr(2, 2), nullptr, 16); int b = std::stoi(payload.substr(4, 2), nullptr, 16); actions.push_back({lineNumber, currentTimestamp, CommandType::COLOR_RGB, "", 0, 0, r, g, b}); } catch (const std::exception&) { std::cerr << "错误: 第 " << lineNumber << " 行颜色代码 '" << payload << "' 转换失败。" << std::endl; return false; }
-                 }
-            } else if (command.rfind("background ",0) == 0){
-                std::string payload = command.substr(11);
-                if(payload.length() != 8 || payload.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
-                    std::cerr << "错误: 第 " << lineNumber << " 行背景颜色代码 '" << payload << "' 格式错误。应为8位十六进制 rrggbbaa。" << std::endl;
-                    return false;
+                if (escape == 2) {
+                    escape = 0;
+                    if (c == 'C') push(Command::SEEK_FORWARD);
+                    else if (c == 'D') push(Command::SEEK_BACK);
+                    else if (c == 'A') push(Command::SPEED_UP);
+                    else if (c == 'B') push(Command::SPEED_DOWN);
+                    continue;
                 }
-                try {
-                    int r = std::stoi(payload.substr(0,2),nullptr,16);
-                    int g = std::stoi(payload.substr(2,2),nullptr,16);
-                    int b = std::stoi(payload.substr(4,2),nullptr,16);
-                    int a = std::stoi(payload.substr(6,2),nullptr,16);
-                    actions.push_back({lineNumber, currentTimestamp, CommandType::BACKGROUND_RGB, "", 0,0,r,g,b,a});
-                } catch (const std::exception&) {
-                    std::cerr << "错误: 第 " << lineNumber << " 行背景颜色代码 '" << payload << "' 转换失败。" << std::endl;
-                    return false;
+                switch (c) {
+                    case '\033': escape = 1; break;
+                    case ' ': case 'p': push(Command::TOGGLE_PAUSE); break;
+                    case 'l': case '.': push(Command::SEEK_FORWARD); break;
+                    case 'h': case ',': push(Command::SEEK_BACK); break;
+                    case '+': case '=': push(Command::SPEED_UP); break;
+                    case '-': case '_': push(Command::SPEED_DOWN); break;
+                    case 'q': case '\003': push(Command::QUIT); break;
+                    default: break;
                 }
             }
-            else if (command.rfind("size ", 0) == 0) std::cerr << "警告: 第 " << lineNumber << " 行：[size] 指令不被支持，将被忽略。" << std::endl;
-            textStart = commandEnd + 1;
         }
     }
-    return true;
-}
 
-// 指令执行函数
-void executeAction(const PlaybackAction& action, const std::string& username) {
-    switch (action.type) {
-        case CommandType::PRINT_TEXT: std::cout << action.text_payload << std::flush; break;
-        case CommandType::NEWLINE: std::cout << '\n' << username << "> " << std::flush; break;
-        case CommandType::NEWLINE_NO_PROMPT: std::cout << '\n'; break;
-        case CommandType::CLEAR_SCREEN: clearScreen(); break;
-        case CommandType::MOVE_CURSOR: moveCursor(action.cursor_row, action.cursor_col); break;
-        case CommandType::STYLE_BOLD: std::cout << "\033[1m"; break;
-        case CommandType::STYLE_ITALIC: std::cout << "\033[3m"; break;
-        case CommandType::STYLE_UNDERLINE: std::cout << "\033[4m"; break;
-        case CommandType::STYLE_STRIKETHROUGH: std::cout << "\033[9m"; break;
-        case CommandType::STYLE_RESET: std::cout << "\033[0m"; break;
-        case CommandType::COLOR_RGB: std::cout << "\033[38;2;" << action.r << ";" << action.g << ";" << action.b << "m"; break;
-        case CommandType::BACKGROUND_RGB: std::cout << "\033[48;2;" << action.r << ";" << action.g << ";" << action.b << "m"; break;
+    // 队列满时丢弃按键
+    void push(Command command) {
+        Command* slot = queue_.writeSlot();
+        if (slot == nullptr) return;
+        *slot = command;
+        queue_.commitWrite();
     }
-}
 
-// 播放主函数
-void play(const std::vector<PlaybackAction>& actions, const std::string& username) {
-    auto startTime = std::chrono::steady_clock::now();
-    for (size_t i = 0; i < actions.size(); ++i) {
-        const auto& currentAction = actions[i];
-        auto targetTime = startTime + currentAction.timestamp;
-        std::this_thread::sleep_until(targetTime);
+    termios saved_{};
+#else
+    void run() {}
+#endif
+
+    SpscRing<Command> queue_;
+    std::thread worker_;
+    std::atomic<bool> stopping_{false};
+    bool active_ = false;
+};
+
+// 播放循环一侧的交互控制: 分段等待下一个 tick，在等待的间隙执行暂停、跳转与变速。
+// 每次改变后，音乐从新的位置重新开始，时间轴随之重新起步，不会因为暂停过而补放一串积压的动作。
+class Transport {
+public:
+    static constexpr std::chrono::milliseconds SEEK_STEP{5000};
+    static constexpr std::chrono::milliseconds SLICE{20}; // 等待时检查按键的间隔
+
+    enum class Result { DUE, RETIMED, SEEKED, QUIT };
+
+    // index 为 nullptr 时忽略跳转; music 为 nullptr 时没有音乐需要跟随
+    Transport(KeyInput& keys, const SeekIndex* index, AudioPlayer* music) : keys_(keys), index_(index), music_(music) {}
+
+    // 等到 deadline (返回 DUE)，或在此之前处理了改变时间轴 (RETIMED)、播放位置 (SEEKED，见 seekTick()) 的命令，或要求退出
+    Result waitUntil(const Scheduler& scheduler, Timeline& timeline, Timeline::Clock::time_point deadline, OutputSink& out) {
+        while (true) {
+            Command command;
+            while (keys_.poll(command)) {
+                const Result result = handle(command, timeline, out);
+                if (result != Result::DUE) return result;
+            }
+            const auto now = Timeline::Clock::now();
+            if (deadline - now <= SLICE) {
+                scheduler.waitUntil(deadline);
+                return Result::DUE;
+            }
+            // 至少留出一整个间隔交给调度器: 普通睡眠的超时不会把最后的逼近推过 deadline
+            std::this_thread::sleep_until(std::min(now + SLICE, deadline - SLICE));
+        }
+    }
+
+    size_t seekTick() const { return seekTick_; }
+
+private:
+    static constexpr double SPEEDS[] = {0.5, 0.75, 1.0, 1.25, 1.5, 2.0, 3.0, 4.0};
+
+    Result handle(Command command, Timeline& timeline, OutputSink& out) {
+        std::chrono::milliseconds position = timeline.position();
+        double speed = timeline.speed();
+        bool seeked = false;
+        if (command == Command::TOGGLE_PAUSE) {
+            // 暂停期间仍可跳转与变速，再按一次继续
+            if (music_ != nullptr) music_->pause();
+            while (true) {
+                std::this_thread::sleep_for(SLICE);
+                if (!keys_.poll(command)) continue;
+                if (command == Command::TOGGLE_PAUSE) break;
+                if (command == Command::QUIT) return Result::QUIT;
+                seeked |= apply(command, position, speed, out);
+            }
+        } else if (command == Command::QUIT) {
+            return Result::QUIT;
+        } else {
+            seeked = apply(command, position, speed, out);
+        }
+        if (music_ != nullptr && !music_->start(position, speed)) {
+            // 与 startMusic 相同: 设备没有重新开始输出，之后改以系统时钟为准，不再控制音乐
+            std::cerr << "警告: 音频设备没有重新开始输出，改用系统时钟。" << std::endl;
+            music_->pause();
+            music_ = nullptr;
+            timeline = Timeline(nullptr, position, speed);
+        }
+        timeline.restart(position, speed);
+        return seeked ? Result::SEEKED : Result::RETIMED;
+    }
+
+    // 跳转或变速，返回是否改变了播放位置
+    bool apply(Command command, std::chrono::milliseconds& position, double& speed, OutputSink& out) {
+        if (command == Command::SPEED_UP) {
+            const double* faster = std::upper_bound(std::begin(SPEEDS), std::end(SPEEDS), speed + 1e-9);
+            if (faster != std::end(SPEEDS)) speed = *faster;
+            return false;
+        }
+        if (command == Command::SPEED_DOWN) {
+            const double* slower = std::lower_bound(std::begin(SPEEDS), std::end(SPEEDS), speed - 1e-9);
+            if (slower != std::begin(SPEEDS)) speed = slower[-1];
+            return false;
+        }
+        if (index_ == nullptr) return false;
+        position = command == Command::SEEK_FORWARD ? position + SEEK_STEP : std::max(std::chrono::milliseconds(0), position - SEEK_STEP);
+        std::string bytes;
+        seekTick_ = index_->seek(position, bytes);
+        out.write(bytes);
+        out.flush();
+        return true;
+    }
+
+    KeyInput& keys_;
+    const SeekIndex* index_;
+    AudioPlayer* music_;
+    size_t seekTick_ = 0;
+};
+
+// 只有完整的 tick 列表可以跳转; 流式播放没有跳转索引，不会收到跳转
+inline void seekSource(TickList& ticks, size_t first) { ticks.seek(first); }
+template <typename Source>
+void seekSource(Source&, size_t) {}
+
+// 播放选项
+struct PlayOptions {
+    bool strict = false;   // 任一 tick 的执行超过到下一个 tick 的间隔即中止 (防超时)，供编写脚本时使用
+    bool skipLate = false; // 追赶时跳过已被后续清屏覆盖的 tick
+    bool noWait = false;   // 虚拟时钟: 不等待，逐个立即写出所有 tick
+};
+
+// 固定内存的对数-线性直方图 (HdrHistogram 的做法): 小于 128 的值逐一计数，更大的值每个 2 的幂区间等分为 64 格，
+// 相对误差不超过 1/64。记录只是一次数组自增，可以放在播放的热路径上。
+class LogHistogram {
+public:
+    static constexpr unsigned SUB_BITS = 7;
+    static constexpr uint64_t SUB_COUNT = 1ull << SUB_BITS;
+    static constexpr uint64_t HALF = SUB_COUNT / 2;
+    static constexpr unsigned MAX_BITS = 40; // 更大的值计入最后一格 (以纳秒计约 18 分钟)
+    static constexpr size_t BUCKETS = SUB_COUNT + (MAX_BITS - SUB_BITS) * HALF;
+
+    void record(uint64_t value) {
+        ++counts_[index(std::min(value, MAX_VALUE))];
+        ++count_;
+        sum_ += value;
+        max_ = std::max(max_, value);
+    }
+
+    // 至少 fraction 比例的样本不超过的值 (取所在格的上界，不超过实际最大值)
+    uint64_t percentile(double fraction) const {
+        if (count_ == 0) return 0;
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * static_cast<double>(count_))));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) return std::min(upperBound(i), max_);
+        }
+        return max_;
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t maxValue() const { return max_; }
+    double mean() const { return count_ == 0 ? 0.0 : static_cast<double>(sum_) / static_cast<double>(count_); }
+
+private:
+    static constexpr uint64_t MAX_VALUE = (1ull << MAX_BITS) - 1;
+
+    static unsigned bitWidth(uint64_t value) {
+#if defined(_MSC_VER) && !defined(__clang__) && (defined(_M_X64) || defined(_M_ARM64))
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<unsigned>(index) + 1;
+#elif defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+        if (value >> 32) { _BitScanReverse(&index, static_cast<uint32_t>(value >> 32)); return static_cast<unsigned>(index) + 33; }
+        _BitScanReverse(&index, static_cast<uint32_t>(value));
+        return static_cast<unsigned>(index) + 1;
+#else
+        return 64 - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+    }
+
+    static size_t index(uint64_t value) {
+        if (value < SUB_COUNT) return static_cast<size_t>(value);
+        const unsigned shift = bitWidth(value) - SUB_BITS;
+        return static_cast<size_t>(SUB_COUNT + (shift - 1) * HALF + ((value >> shift) - HALF));
+    }
+
+    static uint64_t upperBound(size_t index) {
+        if (index < SUB_COUNT) return index;
+        const unsigned shift = static_cast<unsigned>((index - SUB_COUNT) / HALF) + 1;
+        const uint64_t sub = (index - SUB_COUNT) % HALF + HALF;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    uint64_t counts_[BUCKETS] = {};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+};
+
+// 播放统计。延迟为 tick 实际开始写出的时刻与其预定时刻之差。
+struct PlaybackReport {
+    static constexpr std::chrono::milliseconds LATE_THRESHOLD{1};
+
+    size_t ticks = 0;
+    size_t lateTicks = 0; // 延迟超过 LATE_THRESHOLD 的 tick
+    std::chrono::nanoseconds totalLateness{0};
+    std::chrono::nanoseconds maxLateness{0};
+    size_t skippedTicks = 0;
+    uint64_t skippedBytes = 0;
+    bool aborted = false;
+    std::chrono::milliseconds virtualTime{0}; // 不等待时虚拟时钟最终走到的时刻
+    LogHistogram latencies;                   // 每个 tick 的延迟 (纳秒)
+    LogHistogram writeSizes;                  // 每次写出的字节数 (追赶时多个 tick 合并为一次)
+    std::chrono::nanoseconds maxExecution{0}; // 单次写出的最长耗时
+
+    void record(std::chrono::steady_clock::duration lateness) {
+        const auto late = std::max(std::chrono::nanoseconds(0), std::chrono::duration_cast<std::chrono::nanoseconds>(lateness));
+        ++ticks;
+        totalLateness += late;
+        maxLateness = std::max(maxLateness, late);
+        if (late > LATE_THRESHOLD) ++lateTicks;
+        latencies.record(static_cast<uint64_t>(late.count()));
+    }
+
+    void recordWrite(size_t bytes, std::chrono::steady_clock::duration execution) {
+        writeSizes.record(bytes);
+        maxExecution = std::max(maxExecution, std::chrono::duration_cast<std::chrono::nanoseconds>(execution));
+    }
+
+    // 落后得足以察觉时，即使没有 --stats 也提示
+    bool noticeable() const { return maxLateness >= std::chrono::milliseconds(50) || skippedTicks != 0; }
+};
+
+// 播放主函数。Source 需提供 bool next(TickRef&)，取出的 tick 在下一次调用 next() 之前保持有效。
+// 每个 tick 只等待一次，并通过输出后端一次写出。截止时刻始终由 timeline 给出: 某个 tick 耽搁之后，
+// 已经到期的后续 tick 不再等待，合并为一次写出，直到追上时间轴。
+template <typename Source>
+PlaybackReport play(Source& source, OutputSink& out, const Scheduler& scheduler, Timeline& timeline, const PlayOptions& options, Transport* transport = nullptr) {
+    PlaybackReport report;
+    std::string merged; // 追赶时合并的字节
+    timeline.start();
+    auto isDue = [&](const TickRef& tick) { return timeline.deadline(tick.timestamp) <= std::chrono::steady_clock::now(); };
+    TickRef currentTick;
+    bool hasCurrent = source.next(currentTick);
+    if (options.noWait) {
+        // 虚拟时钟直接跳到每个 tick 的时间戳: 不睡眠，也就没有延迟与追赶
+        for (; hasCurrent; hasCurrent = source.next(currentTick)) {
+            report.record(std::chrono::nanoseconds(0));
+            report.virtualTime = currentTick.timestamp;
+            const auto beforeExecute = std::chrono::steady_clock::now();
+            out.writeTick(currentTick);
+            report.recordWrite(currentTick.bytes.size(), std::chrono::steady_clock::now() - beforeExecute);
+        }
+        return report;
+    }
+    while (hasCurrent) {
+        auto targetTime = timeline.deadline(currentTick.timestamp);
+        if (transport == nullptr) {
+            scheduler.waitUntil(targetTime);
+        } else {
+            const Transport::Result result = transport->waitUntil(scheduler, timeline, targetTime, out);
+            if (result == Transport::Result::QUIT) break;
+            if (result == Transport::Result::SEEKED) {
+                seekSource(source, transport->seekTick());
+                hasCurrent = source.next(currentTick);
+            }
+            if (result != Transport::Result::DUE) continue; // 时间轴已重新起步，重新计算截止时刻
+        }
 
         auto beforeExecute = std::chrono::steady_clock::now();
-        executeAction(currentAction, username);
+        report.record(beforeExecute - targetTime);
+        out.writeTick(currentTick);
         auto afterExecute = std::chrono::steady_clock::now();
         auto executionDuration = afterExecute - beforeExecute;
+        report.recordWrite(currentTick.bytes.size(), executionDuration);
 
-        if (i + 1 < actions.size()) {
-            const auto& nextAction = actions[i + 1];
-            auto timeUntilNext = nextAction.timestamp - currentAction.timestamp;
+        const int currentLine = currentTick.sourceLine;
+        hasCurrent = source.next(currentTick);
+        if (options.strict) {
+            if (!hasCurrent) break;
+            auto timeUntilNext = timeline.deadline(currentTick.timestamp) - targetTime; // 倍速播放时按实际时长计算
             if (timeUntilNext.count() > 0 && executionDuration > timeUntilNext) {
                 auto overTime = std::chrono::duration_cast<std::chrono::microseconds>(executionDuration - timeUntilNext);
-                std::cerr << "\n错误: 【防超时】在第 " << currentAction.sourceLineNumber
+                std::cerr << "\n错误: 【防超时】在第 " << currentLine
                           << " 行的动作执行超时！\n"
                           << "详情: 动作耗时 " << std::chrono::duration_cast<std::chrono::microseconds>(executionDuration).count() << " us, "
                           << "但距离下一个动作仅有 " << std::chrono::duration_cast<std::chrono::microseconds>(timeUntilNext).count() << " us。\n"
                           << "超时了 " << overTime.count() << " us。" << std::endl;
-                return;
+                report.aborted = true;
+                return report;
             }
+            continue;
         }
+
+        if (!hasCurrent || !isDue(currentTick)) continue;
+        // 已经落后: 把所有到期的 tick 复制进 merged 一次写出。遇到清屏时，之前合并的内容都会被覆盖，可以丢弃
+        merged.clear();
+        size_t mergedTicks = 0;
+        do {
+            report.record(std::chrono::steady_clock::now() - timeline.deadline(currentTick.timestamp));
+            if (options.skipLate && currentTick.clearOffset != TickRef::NO_CLEAR) {
+                report.skippedTicks += mergedTicks;
+                report.skippedBytes += merged.size() + currentTick.clearOffset;
+                merged.assign(currentTick.restore);
+                merged += currentTick.bytes.substr(currentTick.clearOffset);
+                mergedTicks = 1;
+            } else {
+                merged += currentTick.bytes;
+                ++mergedTicks;
+            }
+            hasCurrent = source.next(currentTick);
+        } while (hasCurrent && isDue(currentTick));
+        const auto beforeMerged = std::chrono::steady_clock::now();
+        out.write(merged);
+        out.flush();
+        report.recordWrite(merged.size(), std::chrono::steady_clock::now() - beforeMerged);
     }
+    return report;
+}
+
+void printPlaybackReport(std::ostream& os, const PlaybackReport& report, const char* prefix) {
+    auto ms = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::milli>(value).count(); };
+    os << prefix << "共 " << report.ticks << " 个 tick，其中 " << report.lateTicks << " 个晚于 " << PlaybackReport::LATE_THRESHOLD.count()
+       << " ms; 累计延迟 " << ms(report.totalLateness) << " ms，最大延迟 " << ms(report.maxLateness) << " ms。";
+    if (report.skippedTicks != 0) os << "追赶时跳过被清屏覆盖的 " << report.skippedTicks << " 个 tick (" << report.skippedBytes << " 字节)。";
+    os << std::endl;
+}
+
+// --latency-report: 延迟分布、最长写出耗时与每次写出的字节数
+void printLatencyReport(const PlaybackReport& report) {
+    const LogHistogram& latencies = report.latencies;
+    auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    std::cout << "延迟 (" << latencies.count() << " 个 tick): p50 " << us(latencies.percentile(0.5)) << " us, p99 " << us(latencies.percentile(0.99))
+              << " us, p99.9 " << us(latencies.percentile(0.999)) << " us, 最大 " << us(latencies.maxValue()) << " us" << std::endl;
+    std::cout << "写出耗时: 最长 " << us(static_cast<uint64_t>(report.maxExecution.count())) << " us" << std::endl;
+    const LogHistogram& sizes = report.writeSizes;
+    std::cout << "每次写出 (" << sizes.count() << " 次): 平均 " << sizes.mean() << " 字节, p50 " << sizes.percentile(0.5) << " 字节, p99 "
+              << sizes.percentile(0.99) << " 字节, 最大 " << sizes.maxValue() << " 字节" << std::endl;
+}
+
+// --no-wait 的吞吐量统计: 从开始加载到写完最后一个 tick 的总用时，以及换算出的每秒动作数
+void printThroughput(size_t actions, const PlaybackReport& report, uint64_t bytes, std::chrono::steady_clock::duration elapsed) {
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << std::endl << "无等待播放: " << actions << " 个动作, " << report.ticks << " 个 tick, " << bytes << " 字节; 脚本时长 "
+              << std::chrono::duration<double>(report.virtualTime).count() << " s, 实际用时 " << seconds * 1000 << " ms, 每秒 "
+              << static_cast<uint64_t>(seconds > 0 ? actions / seconds : 0) << " 个动作" << std::endl;
 }
 
 // Windows 控制台配置函数
@@ -272,7 +3090,8 @@ void configureWindowsConsole() {
 #endif
 }
 
-// Main 函数
+// Main 函数。测试直接包含本文件，定义 CLIPLAYER_NO_MAIN 以去掉入口。
+#ifndef CLIPLAYER_NO_MAIN
 int main(int argc, char* argv[]) {
     // configureWindowsConsole();
     // if (argc != 2) { std::cerr << "使用方法: " << argv[0] << " <文件名.clip>" << std::endl; return 1; }
@@ -284,33 +3103,241 @@ int main(int argc, char* argv[]) {
 
     // if (!parseFile(filename, actions, username)) return 1;
     configureWindowsConsole();
-    if (argc < 2) {std::cerr << "使用方法: " << argv[0] << " <文件名.clip> [--music <音频文件.mp3>]" << std::endl; return 1;}
+    if (argc >= 2 && std::string(argv[1]) == "--bench-tokenizer") return runTokenizerBenchmark();
+    if (argc < 2) {std::cerr << "使用方法: " << argv[0] << " <文件名.clip|.clipb> [--music <音频文件.mp3>] [--scanner auto|avx2|sse2|scalar] [--compile <输出.clipb>] [--jobs N] [--stream] [--stats] [--nonblocking] [--render direct|diff] [--colors auto|truecolor|256|16] [--sched sleep|hybrid|spin] [--strict] [--skip-late] [--clock audio|system] [--start-at mm.ss.zzz] [--speed 0.5~4.0] [--interactive] [--sink stdout|null] [--no-wait] [--latency-report]" << std::endl; return 1;}
     enableAnsiSupport();
 
     std::string filename = argv[1];
     std::string music_path;
+    std::string compile_path;
+    unsigned jobs = 1;
+    bool stream_mode = false;
+    bool show_stats = false;
+    bool nonblocking = false;
+    RenderMode render_mode = RenderMode::DIRECT;
+    ColorDepth color_depth = detectColorDepth();
+    SchedMode sched_mode = SchedMode::HYBRID;
+    PlayOptions play_options;
+    bool follow_audio = true;
+    std::chrono::milliseconds start_at{0};
+    double speed = 1.0;
+    bool interactive = false;
+    bool discard_output = false;
+    bool latency_report = false;
     for(int i = 2;i<argc;++i) {
-        if (std::string(argv[i]) == "--music" && i+1<argc) {
-            music_path = argv[i+1];
-            break;
+        std::string arg = argv[i];
+        if (arg == "--music" && i+1<argc) {
+            music_path = argv[++i];
+        } else if (arg == "--compile" && i+1<argc) {
+            compile_path = argv[++i];
+        } else if (arg == "--stream") {
+            stream_mode = true;
+        } else if (arg == "--stats") {
+            show_stats = true;
+        } else if (arg == "--nonblocking") {
+            nonblocking = true;
+        } else if (arg == "--no-wait") {
+            play_options.noWait = true;
+        } else if (arg == "--sink" && i+1<argc) {
+            std::string sink = argv[++i];
+            if (sink == "stdout") discard_output = false;
+            else if (sink == "null") discard_output = true;
+            else { std::cerr << "错误: 未知的输出目标 '" << sink << "'。可选: stdout, null" << std::endl; return 1; }
+        } else if (arg == "--latency-report") {
+            latency_report = true;
+        } else if (arg == "--interactive") {
+            interactive = true;
+        } else if (arg == "--strict") {
+            play_options.strict = true;
+        } else if (arg == "--skip-late") {
+            play_options.skipLate = true;
+        } else if (arg == "--render" && i+1<argc) {
+            std::string mode = argv[++i];
+            if (mode == "direct") render_mode = RenderMode::DIRECT;
+            else if (mode == "diff") render_mode = RenderMode::DIFF;
+            else { std::cerr << "错误: 未知的渲染方式 '" << mode << "'。可选: direct, diff" << std::endl; return 1; }
+        } else if (arg == "--colors" && i+1<argc) {
+            std::string depth = argv[++i];
+            if (depth == "auto") color_depth = detectColorDepth();
+            else if (depth == "truecolor") color_depth = ColorDepth::TRUECOLOR;
+            else if (depth == "256") color_depth = ColorDepth::PALETTE_256;
+            else if (depth == "16") color_depth = ColorDepth::PALETTE_16;
+            else { std::cerr << "错误: 未知的色深 '" << depth << "'。可选: auto, truecolor, 256, 16" << std::endl; return 1; }
+        } else if (arg == "--sched" && i+1<argc) {
+            std::string mode = argv[++i];
+            if (mode == "sleep") sched_mode = SchedMode::SLEEP;
+            else if (mode == "hybrid") sched_mode = SchedMode::HYBRID;
+            else if (mode == "spin") sched_mode = SchedMode::SPIN;
+            else { std::cerr << "错误: 未知的调度方式 '" << mode << "'。可选: sleep, hybrid, spin" << std::endl; return 1; }
+        } else if (arg == "--clock" && i+1<argc) {
+            std::string clock = argv[++i];
+            if (clock == "audio") follow_audio = true;
+            else if (clock == "system") follow_audio = false;
+            else { std::cerr << "错误: 未知的时钟 '" << clock << "'。可选: audio, system" << std::endl; return 1; }
+        } else if (arg == "--start-at" && i+1<argc) {
+            if (!parseTimestamp(argv[++i], start_at)) { std::cerr << "错误: --start-at 需要 mm.ss.zzz 格式的时间戳。" << std::endl; return 1; }
+        } else if (arg == "--speed" && i+1<argc) {
+            char* end = nullptr;
+            speed = std::strtod(argv[++i], &end);
+            if (end == argv[i] || *end != '\0' || !(speed >= 0.5 && speed <= 4.0)) { std::cerr << "错误: --speed 需要 0.5 到 4.0 之间的倍率。" << std::endl; return 1; }
+        } else if (arg == "--jobs" && i+1<argc) {
+            int value = 0;
+            std::string_view text = argv[++i];
+            if (!readInt(text, value) || !text.empty() || value < 0) { std::cerr << "错误: --jobs 需要一个非负整数 (0 表示使用全部 CPU 核心)。" << std::endl; return 1; }
+            jobs = value == 0 ? std::max(1u, std::thread::hardware_concurrency()) : static_cast<unsigned>(value);
+        } else if (arg == "--scanner" && i+1<argc) {
+            if (!selectScanner(argv[++i])) { std::cerr << "错误: 未知或当前 CPU 不支持的扫描实现 '" << argv[i] << "'。可选: auto, avx2, sse2, scalar" << std::endl; return 1; }
         }
     }
 
-    std::unique_ptr<AudioPlayer> player;
+    if (!compile_path.empty()) {
+        Script script;
+        if (!loadScript(filename, script, jobs)) return 1;
+        if (!writeCompiledScript(compile_path, script, filename)) return 1;
+        if (show_stats) printTextStats(script);
+        return 0;
+    }
+
+    if (play_options.noWait) {
+        // 只为测量吞吐量，音乐与按键都没有意义
+        if (!music_path.empty()) std::cerr << "警告: --no-wait 不播放音乐。" << std::endl;
+        music_path.clear();
+        interactive = false;
+    }
+
+    const Scheduler scheduler(sched_mode);
+    const auto load_start = std::chrono::steady_clock::now();
+    // 音频引擎在后台初始化并解码音乐，与脚本解析同时进行; 开始播放要等到画面就绪
+    std::future<std::unique_ptr<AudioPlayer>> loading;
     if (!music_path.empty()) {
-        player = std::make_unique<AudioPlayer>(music_path);
+        loading = std::async(std::launch::async, [music_path] { return std::make_unique<AudioPlayer>(music_path); });
+    }
+    std::unique_ptr<AudioPlayer> player;
+    auto awaitPlayer = [&] {
+        if (!loading.valid()) return;
+        player = loading.get();
+        if (!player->warning.empty()) std::cerr << player->warning << std::endl;
+    };
+    KeyInput keys;
+    auto startKeys = [&] {
+        if (interactive && !keys.start()) {
+            std::cerr << "警告: 标准输入不是终端，--interactive 无效。" << std::endl;
+            interactive = false;
+        }
+    };
+    auto music = [&] { return player && player->initialized ? player.get() : nullptr; };
+    // --stats 中与输出和调度相关的部分，流式与非流式播放共用
+    auto printOutputStats = [&](const OutputSink& output, const Timeline& timeline, const PlaybackReport& report) {
+        std::cout << "终端输出: " << output.bytesWritten() << " 字节, " << output.syscalls() << " 次写入系统调用";
+        if (nonblocking) std::cout << ", 积压时合并丢弃 " << output.collapsedBytes() << " 字节";
+        std::cout << std::endl;
+        if (scheduler.mode() == SchedMode::HYBRID) std::cout << "调度: 睡眠后自旋，校准余量 " << std::chrono::duration_cast<std::chrono::microseconds>(scheduler.margin()).count() << " us" << std::endl;
+        if (timeline.followsAudio()) std::cout << "时钟: 以音乐为准，设备延迟 " << std::chrono::duration_cast<std::chrono::milliseconds>(player->latency()).count() << " ms" << std::endl;
+        printPlaybackReport(std::cout, report, "播放: ");
+    };
+
+    Script script;
+    if (stream_mode) {
+        if (!script.source.open(filename)) { std::cerr << "错误: 无法打开文件 '" << filename << "'" << std::endl; return 1; }
     }
+    if (stream_mode && !isCompiledScript(script.source.view())) {
+        // 流式模式: 解析线程边解析边入队，第一个动作就绪后立即开始播放
+        if (start_at.count() > 0) { std::cerr << "错误: --start-at 需要完整的动作表，不能与 --stream 一同用于文本脚本。" << std::endl; return 1; }
+        size_t bodyStart = 0;
+        int lineBase = 0;
+        if (!parseUsernameLine(script.source.view(), script, bodyStart, lineBase)) return 1;
+        std::unique_ptr<Renderer> renderer = makeRenderer(render_mode, script.username, color_depth); // 须比 stream 活得久
+        ActionStream stream;
+        stream.start(script.source.view().substr(bodyStart), lineBase, *renderer);
+        stream.waitUntilReady();
 
-    std::vector<PlaybackAction> actions;
-    std::string username = "user@cliplayer";
+        awaitPlayer();
+        startKeys();
+        std::unique_ptr<OutputSink> output = makeOutput(nonblocking, discard_output);
+        showPrompt(*output, script.username);
+        Timeline timeline = startMusic(player.get(), follow_audio, start_at, speed);
+        Transport transport(keys, nullptr, music()); // 流式播放不能跳转
+        const PlaybackReport report = play(stream, *output, scheduler, timeline, play_options, interactive ? &transport : nullptr);
+        keys.stop();
+        output->write("\033[0m");
+        output->finish();
+        stream.stop();
+        if (play_options.noWait) printThroughput(stream.actionCount(), report, output->bytesWritten(), std::chrono::steady_clock::now() - load_start);
+        if (show_stats) {
+            std::cout << std::endl;
+            printStreamStats(stream);
+            printOutputStats(*output, timeline, report);
+        } else if (report.noticeable()) {
+            printPlaybackReport(std::cerr, report, "\n警告: 播放曾落后于时间轴。");
+        }
+        if (latency_report) {
+            if (!play_options.noWait) std::cout << std::endl;
+            printLatencyReport(report);
+        }
+        if (!stream.diagnostics().empty()) std::cout << std::endl;
+        for (const Diagnostic& diagnostic : stream.diagnostics()) printDiagnostic(diagnostic);
+        return stream.failed() ? 1 : 0;
+    }
+
+    if (stream_mode) {
+        if (!loadCompiledScript(filename, script.source.view(), script)) return 1;
+        script.actions.texts().freeze();
+    } else if (!loadScript(filename, script, jobs)) {
+        return 1;
+    }
 
-    if(!parseFile(filename, actions, username)) return 1;
+    const auto render_start = std::chrono::steady_clock::now();
+    std::unique_ptr<Renderer> renderer = makeRenderer(render_mode, script.username, color_depth);
+    std::unique_ptr<Renderer> initial = start_at.count() > 0 || interactive ? renderer->clone() : nullptr; // 跳转索引从头重放时使用
+    renderTicks(script.actions, *renderer, script.rendered);
 
-    clearScreen();
-    std::cout << "\033[0m" << username << "> " << std::flush;
-    play(actions, username);
-    std::cout << "\033[0m";
+    // 从中途开始: 先重现起点时刻的终端画面
+    std::unique_ptr<SeekIndex> seek_index;
+    std::string seek_bytes;
+    size_t first_tick = 0;
+    if (initial) {
+        int rows = 0;
+        int cols = 0;
+        terminalSize(rows, cols);
+        seek_index = std::make_unique<SeekIndex>(script.actions, script.rendered, *initial, ScreenRenderer(script.username, rows, cols, color_depth));
+        if (start_at.count() > 0) {
+            first_tick = seek_index->seek(start_at, seek_bytes);
+            if (first_tick == script.rendered.size()) std::cerr << "警告: 起点晚于脚本的最后一个动作。" << std::endl;
+        }
+    }
+
+    awaitPlayer();
+    startKeys();
+    const auto play_start = std::chrono::steady_clock::now();
+    std::unique_ptr<OutputSink> output = makeOutput(nonblocking, discard_output);
+    showPrompt(*output, script.username);
+    output->write(seek_bytes);
+    TickList ticks(script.rendered, first_tick);
+    Timeline timeline = startMusic(player.get(), follow_audio, start_at, speed);
+    Transport transport(keys, seek_index.get(), music());
+    const PlaybackReport report = play(ticks, *output, scheduler, timeline, play_options, interactive ? &transport : nullptr);
+    keys.stop();
+    output->write("\033[0m");
+    output->finish();
+    if (play_options.noWait) {
+        const auto play_end = std::chrono::steady_clock::now();
+        auto ms = [](std::chrono::steady_clock::duration value) { return std::chrono::duration<double, std::milli>(value).count(); };
+        printThroughput(script.actions.size(), report, output->bytesWritten(), play_end - load_start);
+        std::cout << "其中加载 " << ms(render_start - load_start) << " ms, 预渲染 " << ms(play_start - render_start) << " ms, 输出 " << ms(play_end - play_start) << " ms" << std::endl;
+    }
+    if (show_stats) {
+        std::cout << std::endl;
+        printTextStats(script);
+        printOutputStats(*output, timeline, report);
+    } else if (report.noticeable()) {
+        printPlaybackReport(std::cerr, report, "\n警告: 播放曾落后于时间轴。");
+    }
+    if (latency_report) {
+        if (!show_stats && !play_options.noWait) std::cout << std::endl;
+        printLatencyReport(report);
+    }
 
     // std::cout << std::endl << "播放结束。" << std::endl;
     return 0;
-}
\ No newline at end of file
+}
+#endif
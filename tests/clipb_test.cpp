@@ -0,0 +1,66 @@
+// .clipb 加载回归测试: 截断或文件头被篡改的编译文件必须被拒绝，而不是越过数据末尾读取。
+#define CLIPLAYER_NO_MAIN
+#include "../CLIPlayer.cpp"
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+    if (!condition) {
+        std::cerr << "失败: " << what << std::endl;
+        ++failures;
+    }
+}
+
+ClipbHeader validHeader() {
+    ClipbHeader header{};
+    std::memcpy(header.magic, CLIPB_MAGIC, sizeof(CLIPB_MAGIC));
+    header.version = CLIPB_VERSION;
+    header.endianTag = CLIPB_ENDIAN_TAG;
+    return header;
+}
+
+// 文件头之后附带 payload 字节的负载
+bool load(const ClipbHeader& header, size_t payload) {
+    std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+    data.append(payload, '\0');
+    Script script;
+    return loadCompiledScript("test.clipb", data, script);
+}
+
+} // namespace
+
+int main() {
+    {
+        const std::string data(sizeof(ClipbHeader) - 1, '\0');
+        Script script;
+        check(!loadCompiledScript("test.clipb", data, script), "拒绝不完整的文件头");
+    }
+    {
+        // 动作表恰好占满负载，blobSize 使 tableBytes + blobSize 在 uint64 上回绕到负载大小
+        const size_t payload = 10 * sizeof(ClipbAction);
+        ClipbHeader header = validHeader();
+        header.actionCount = (sizeof(ClipbHeader) + payload) / sizeof(ClipbAction);
+        header.blobSize = payload - header.actionCount * sizeof(ClipbAction);
+        check(!load(header, payload), "拒绝大小回绕的动作数");
+    }
+    {
+        ClipbHeader header = validHeader();
+        header.actionCount = 1;
+        header.blobSize = UINT64_MAX - sizeof(ClipbAction) + 1 + 16; // 与动作表相加回绕为 16
+        check(!load(header, 16), "拒绝大小回绕的字符串池");
+    }
+    {
+        ClipbHeader header = validHeader();
+        header.actionCount = 2;
+        check(!load(header, sizeof(ClipbAction)), "拒绝被截断的动作表");
+    }
+    {
+        ClipbHeader header = validHeader();
+        header.blobSize = 8;
+        check(!load(header, 4), "拒绝被截断的字符串池");
+    }
+    if (failures == 0) std::cout << "clipb_test: 通过" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
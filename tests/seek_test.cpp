@@ -0,0 +1,54 @@
+// SeekIndex 回归测试: 向前跳转之后再跳回开头，必须清屏并重画初始提示符，而不是在旧画面上继续输出。
+#define CLIPLAYER_NO_MAIN
+#include "../CLIPlayer.cpp"
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+    if (!condition) {
+        std::cerr << "失败: " << what << std::endl;
+        ++failures;
+    }
+}
+
+void seekForwardThenBack(RenderMode mode) {
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "cliplayer_seek_test.clip";
+    {
+        std::ofstream file(path);
+        file << "[username]u\n"
+                "[00.01.000][color ff0000]AAA\n"
+                "[00.02.000][newline]BBB\n"
+                "[00.03.000][clear]u> CCC\n";
+    }
+    Script script;
+    const bool loaded = loadScript(path.string(), script);
+    std::filesystem::remove(path);
+    check(loaded, "加载测试脚本");
+    if (!loaded) return;
+
+    std::unique_ptr<Renderer> renderer = makeRenderer(mode, script.username, ColorDepth::TRUECOLOR);
+    std::unique_ptr<Renderer> initial = renderer->clone();
+    renderTicks(script.actions, *renderer, script.rendered);
+    SeekIndex index(script.actions, script.rendered, *initial, ScreenRenderer(script.username, 24, 80, ColorDepth::TRUECOLOR));
+
+    std::string forward;
+    check(index.seek(std::chrono::milliseconds(3000), forward) == 2, "向前跳转到第三个 tick");
+    check(forward.find("BBB") != std::string::npos, "向前跳转重画第三个 tick 之前的画面");
+
+    std::string back;
+    check(index.seek(std::chrono::milliseconds(0), back) == 0, "跳回开头从第一个 tick 播放");
+    check(back.rfind("\033[0m\033[2J\033[H", 0) == 0, "跳回开头先重置属性并清屏");
+    check(back.find("u> ") != std::string::npos, "跳回开头重画提示符");
+    check(back.find("AAA") == std::string::npos && back.find("BBB") == std::string::npos, "跳回开头不残留任何动作的输出");
+}
+
+} // namespace
+
+int main() {
+    seekForwardThenBack(RenderMode::DIRECT);
+    seekForwardThenBack(RenderMode::DIFF);
+    if (failures == 0) std::cout << "seek_test: 通过" << std::endl;
+    return failures == 0 ? 0 : 1;
+}